@@ -0,0 +1,157 @@
+#ifndef _ALLOC_COUNTER_H_
+#define _ALLOC_COUNTER_H_
+
+// Replaces the global operator new and delete to count heap allocations.
+// Include it from exactly one translation unit of a benchmark binary.
+// Every form is replaced so memory from any new reaches a matching delete,
+// and none is inlined so the compiler never pairs malloc with a delete.
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#ifdef _MSC_VER
+#include <malloc.h>
+#define ALLOC_COUNTER_NOINLINE __declspec(noinline)
+#else
+#define ALLOC_COUNTER_NOINLINE __attribute__((noinline))
+#endif
+
+inline std::atomic<size_t> g_alloc_num{0};
+inline std::atomic<size_t> g_alloc_bytes{0};
+
+inline void* CountedAlloc(size_t size) noexcept {
+  g_alloc_num.fetch_add(1, std::memory_order_relaxed);
+  g_alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+  return std::malloc(size ? size : 1);
+}
+
+inline void* CountedAlloc(size_t size, std::align_val_t align) noexcept {
+  g_alloc_num.fetch_add(1, std::memory_order_relaxed);
+  g_alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+  size_t alignment = static_cast<size_t>(align);
+#ifdef _MSC_VER
+  return _aligned_malloc(size ? size : 1, alignment);
+#else
+  // aligned_alloc takes a nonzero multiple of the alignment
+  size_t rounded = (size + alignment - 1) / alignment * alignment;
+  return std::aligned_alloc(alignment, rounded ? rounded : alignment);
+#endif
+}
+
+inline void CountedFree(void* p) noexcept { std::free(p); }
+
+inline void CountedFree(void* p, std::align_val_t) noexcept {
+#ifdef _MSC_VER
+  _aligned_free(p);
+#else
+  std::free(p);
+#endif
+}
+
+ALLOC_COUNTER_NOINLINE void* operator new(size_t size) {
+  if (void* p = CountedAlloc(size)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+ALLOC_COUNTER_NOINLINE void* operator new[](size_t size) {
+  if (void* p = CountedAlloc(size)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+ALLOC_COUNTER_NOINLINE void* operator new(size_t size,
+                                          const std::nothrow_t&) noexcept {
+  return CountedAlloc(size);
+}
+
+ALLOC_COUNTER_NOINLINE void* operator new[](size_t size,
+                                            const std::nothrow_t&) noexcept {
+  return CountedAlloc(size);
+}
+
+ALLOC_COUNTER_NOINLINE void* operator new(size_t size, std::align_val_t align) {
+  if (void* p = CountedAlloc(size, align)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+ALLOC_COUNTER_NOINLINE void* operator new[](size_t size,
+                                            std::align_val_t align) {
+  if (void* p = CountedAlloc(size, align)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+ALLOC_COUNTER_NOINLINE void* operator new(size_t size, std::align_val_t align,
+                                          const std::nothrow_t&) noexcept {
+  return CountedAlloc(size, align);
+}
+
+ALLOC_COUNTER_NOINLINE void* operator new[](size_t size, std::align_val_t align,
+                                            const std::nothrow_t&) noexcept {
+  return CountedAlloc(size, align);
+}
+
+ALLOC_COUNTER_NOINLINE void operator delete(void* p) noexcept {
+  CountedFree(p);
+}
+
+ALLOC_COUNTER_NOINLINE void operator delete[](void* p) noexcept {
+  CountedFree(p);
+}
+
+ALLOC_COUNTER_NOINLINE void operator delete(void* p, size_t) noexcept {
+  CountedFree(p);
+}
+
+ALLOC_COUNTER_NOINLINE void operator delete[](void* p, size_t) noexcept {
+  CountedFree(p);
+}
+
+ALLOC_COUNTER_NOINLINE void operator delete(void* p,
+                                            const std::nothrow_t&) noexcept {
+  CountedFree(p);
+}
+
+ALLOC_COUNTER_NOINLINE void operator delete[](void* p,
+                                              const std::nothrow_t&) noexcept {
+  CountedFree(p);
+}
+
+ALLOC_COUNTER_NOINLINE void operator delete(void* p,
+                                            std::align_val_t align) noexcept {
+  CountedFree(p, align);
+}
+
+ALLOC_COUNTER_NOINLINE void operator delete[](void* p,
+                                              std::align_val_t align) noexcept {
+  CountedFree(p, align);
+}
+
+ALLOC_COUNTER_NOINLINE void operator delete(void* p, size_t,
+                                            std::align_val_t align) noexcept {
+  CountedFree(p, align);
+}
+
+ALLOC_COUNTER_NOINLINE void operator delete[](void* p, size_t,
+                                              std::align_val_t align) noexcept {
+  CountedFree(p, align);
+}
+
+ALLOC_COUNTER_NOINLINE void operator delete(void* p, std::align_val_t align,
+                                            const std::nothrow_t&) noexcept {
+  CountedFree(p, align);
+}
+
+ALLOC_COUNTER_NOINLINE void operator delete[](void* p, std::align_val_t align,
+                                              const std::nothrow_t&) noexcept {
+  CountedFree(p, align);
+}
+
+#endif
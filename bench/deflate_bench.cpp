@@ -0,0 +1,273 @@
+// permessage-deflate cost and gain on signaling traffic, per server window
+// size, with and without server context takeover, and the same for messages
+// deflated with the preset sdp dictionary. Each connection receives what a
+// peer does during one call setup, an offer or an answer and its trickled
+// candidates, so takeover only gains from what repeats within a connection.
+//
+// Usage: deflate_bench [sdp_file...]
+// Recorded sdp files replace the synthetic browser-like corpus.
+
+#include <zlib.h>
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <nlohmann/json.hpp>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "deflate_extension.h"
+#include "sdp_dictionary.h"
+
+using nlohmann::json;
+
+namespace {
+
+std::string RandomToken(std::mt19937* rng, size_t size) {
+  static const char kChars[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string token;
+  for (size_t i = 0; i < size; ++i) {
+    token += kChars[(*rng)() % 64];
+  }
+  return token;
+}
+
+std::string Fingerprint(std::mt19937* rng) {
+  char byte[4];
+  std::string fingerprint;
+  for (int i = 0; i < 32; ++i) {
+    std::snprintf(byte, sizeof(byte), "%s%02X", i ? ":" : "",
+                  static_cast<unsigned>((*rng)() & 0xff));
+    fingerprint += byte;
+  }
+  return fingerprint;
+}
+
+// An offer shaped like the ones browsers send for one audio and one video
+// track: the codec lists repeat across offers, ids and keys do not
+std::string MakeBrowserSdp(std::mt19937* rng) {
+  std::string ufrag = RandomToken(rng, 4);
+  std::string pwd = RandomToken(rng, 24);
+  std::string fingerprint = Fingerprint(rng);
+  std::string msid = RandomToken(rng, 36);
+  std::ostringstream sdp;
+  sdp << "v=0\r\no=- " << (*rng)() << (*rng)()
+      << " 2 IN IP4 127.0.0.1\r\ns=-\r\nt=0 0\r\n"
+      << "a=group:BUNDLE 0 1\r\na=extmap-allow-mixed\r\n"
+      << "a=msid-semantic: WMS " << msid << "\r\n";
+
+  const char* kinds[] = {"audio", "video"};
+  for (int m = 0; m < 2; ++m) {
+    bool video = 1 == m;
+    sdp << "m=" << kinds[m] << " 9 UDP/TLS/RTP/SAVPF "
+        << (video ? "96 97 102 103 104 105 106 107 108 109 127 125 39 40 45 "
+                    "46 98 99 100 101 112 113 116 117 118"
+                  : "111 63 9 0 8 13 110 126")
+        << "\r\nc=IN IP4 0.0.0.0\r\na=rtcp:9 IN IP4 0.0.0.0\r\n"
+        << "a=ice-ufrag:" << ufrag << "\r\na=ice-pwd:" << pwd
+        << "\r\na=ice-options:trickle\r\na=fingerprint:sha-256 "
+        << fingerprint << "\r\na=setup:actpass\r\na=mid:" << m << "\r\n";
+    const char* extmaps[] = {
+        "urn:ietf:params:rtp-hdrext:ssrc-audio-level",
+        "http://www.webrtc.org/experiments/rtp-hdrext/abs-send-time",
+        "http://www.ietf.org/id/"
+        "draft-holmer-rmcat-transport-wide-cc-extensions-01",
+        "urn:ietf:params:rtp-hdrext:sdes:mid",
+        "urn:ietf:params:rtp-hdrext:toffset",
+        "urn:3gpp:video-orientation",
+        "http://www.webrtc.org/experiments/rtp-hdrext/playout-delay",
+        "http://www.webrtc.org/experiments/rtp-hdrext/video-content-type",
+        "http://www.webrtc.org/experiments/rtp-hdrext/video-timing",
+        "http://www.webrtc.org/experiments/rtp-hdrext/color-space",
+        "urn:ietf:params:rtp-hdrext:sdes:rtp-stream-id",
+        "urn:ietf:params:rtp-hdrext:sdes:repaired-rtp-stream-id"};
+    for (int i = 0; i < (video ? 12 : 4); ++i) {
+      sdp << "a=extmap:" << i + 1 << " " << extmaps[i] << "\r\n";
+    }
+    sdp << "a=sendrecv\r\na=msid:" << msid << " " << RandomToken(rng, 36)
+        << "\r\na=rtcp-mux\r\n";
+    if (video) {
+      sdp << "a=rtcp-rsize\r\n";
+      const char* codecs[] = {"VP8", "VP9", "H264", "AV1", "H265"};
+      for (int pt = 96; pt < 119; pt += 2) {
+        const char* codec = codecs[(pt - 96) / 2 % 5];
+        sdp << "a=rtpmap:" << pt << " " << codec << "/90000\r\n"
+            << "a=rtcp-fb:" << pt << " goog-remb\r\na=rtcp-fb:" << pt
+            << " transport-cc\r\na=rtcp-fb:" << pt << " ccm fir\r\n"
+            << "a=rtcp-fb:" << pt << " nack\r\na=rtcp-fb:" << pt
+            << " nack pli\r\n";
+        if (0 == std::string("H264").compare(codec)) {
+          sdp << "a=fmtp:" << pt
+              << " level-asymmetry-allowed=1;packetization-mode=1;"
+                 "profile-level-id=42e01f\r\n";
+        }
+        sdp << "a=rtpmap:" << pt + 1 << " rtx/90000\r\na=fmtp:" << pt + 1
+            << " apt=" << pt << "\r\n";
+      }
+      unsigned ssrc = (*rng)();
+      unsigned rtx_ssrc = (*rng)();
+      std::string cname = RandomToken(rng, 16);
+      sdp << "a=ssrc-group:FID " << ssrc << " " << rtx_ssrc << "\r\n"
+          << "a=ssrc:" << ssrc << " cname:" << cname << "\r\n"
+          << "a=ssrc:" << rtx_ssrc << " cname:" << cname << "\r\n";
+    } else {
+      sdp << "a=rtpmap:111 opus/48000/2\r\na=rtcp-fb:111 transport-cc\r\n"
+          << "a=fmtp:111 minptime=10;useinbandfec=1\r\n"
+          << "a=rtpmap:63 red/48000/2\r\na=fmtp:63 111/111\r\n"
+          << "a=rtpmap:9 G722/8000\r\na=rtpmap:0 PCMU/8000\r\n"
+          << "a=rtpmap:8 PCMA/8000\r\na=rtpmap:13 CN/8000\r\n"
+          << "a=rtpmap:110 telephone-event/48000\r\n"
+          << "a=rtpmap:126 telephone-event/8000\r\n"
+          << "a=ssrc:" << (*rng)() << " cname:" << RandomToken(rng, 16)
+          << "\r\n";
+    }
+  }
+  return sdp.str();
+}
+
+// A trickled candidate as browsers send them, host or srflx
+std::string MakeCandidate(std::mt19937* rng, const std::string& ufrag,
+                          int index) {
+  std::ostringstream candidate;
+  bool srflx = 0 != index % 3;
+  candidate << "candidate:" << (*rng)() << " " << 1 + index % 2 << " udp "
+            << (srflx ? 1677729535 : 2122260223) << " "
+            << (srflx ? "203.0.113." : "192.168.1.") << (*rng)() % 254 + 1
+            << " " << 40000 + (*rng)() % 20000 << " typ "
+            << (srflx ? "srflx raddr 0.0.0.0 rport 0" : "host")
+            << " generation 0 ufrag " << ufrag << " network-id 1";
+  return candidate.str();
+}
+
+std::string ReadFile(const char* path) {
+  std::ifstream file(path, std::ios::binary);
+  std::ostringstream content;
+  content << file.rdbuf();
+  return content.str();
+}
+
+// Compresses the messages of a connection in sequence through one stream that
+// keeps its window, the way websocketpp does with context takeover
+bool DeflateWithTakeover(const std::vector<std::string>& messages,
+                         int window_bits, size_t* compressed) {
+  z_stream stream = {};
+  // Same memory level websocketpp uses for its per connection contexts
+  if (Z_OK != deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                           -window_bits, 4, Z_DEFAULT_STRATEGY)) {
+    return false;
+  }
+  std::string out;
+  for (const auto& message : messages) {
+    out.resize(deflateBound(&stream, message.size()) + 16);
+    stream.next_in =
+        reinterpret_cast<Bytef*>(const_cast<char*>(message.data()));
+    stream.avail_in = static_cast<uInt>(message.size());
+    stream.next_out = reinterpret_cast<Bytef*>(&out[0]);
+    stream.avail_out = static_cast<uInt>(out.size());
+    deflate(&stream, Z_SYNC_FLUSH);
+    *compressed += out.size() - stream.avail_out - 4;
+  }
+  deflateEnd(&stream);
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  std::vector<std::string> sdps;
+  for (int i = 1; i < argc; ++i) {
+    sdps.push_back(ReadFile(argv[i]));
+  }
+  std::mt19937 rng(20240501);
+  while (sdps.size() < 64) {
+    sdps.push_back(MakeBrowserSdp(&rng));
+  }
+
+  // The frames the server relays to each connection: an offer or an answer,
+  // then 10 to 20 candidates
+  std::vector<std::vector<std::string>> connections;
+  size_t raw = 0;
+  size_t message_num = 0;
+  for (size_t i = 0; i < sdps.size(); ++i) {
+    std::vector<std::string> messages;
+    messages.push_back(json({{"type", i % 2 ? "answer" : "offer"},
+                             {"transmission_id", "000000"},
+                             {"user_id", "300000002"},
+                             {"remote_user_id", "300000001"},
+                             {"sdp", sdps[i]}})
+                           .dump());
+    std::string ufrag = RandomToken(&rng, 4);
+    int candidate_num = 10 + rng() % 11;
+    for (int j = 0; j < candidate_num; ++j) {
+      messages.push_back(json({{"type", "new_candidate"},
+                               {"transmission_id", "000000"},
+                               {"user_id", "300000002"},
+                               {"remote_user_id", "300000001"},
+                               {"sdp", MakeCandidate(&rng, ufrag, j)}})
+                             .dump());
+    }
+    for (const auto& message : messages) {
+      raw += message.size();
+    }
+    message_num += messages.size();
+    connections.push_back(std::move(messages));
+  }
+  std::printf("%zu connections, %zu messages, %.0f bytes on average\n\n",
+              connections.size(), message_num,
+              static_cast<double>(raw) / message_num);
+  std::printf("%-7s %-9s %8s %8s %12s %10s\n", "bits", "takeover", "ratio",
+              "bytes", "us/message", "MB/s");
+
+  const int kRounds = 20;
+  for (int bits = 9; bits <= 15; ++bits) {
+    for (int takeover = 0; takeover < 2; ++takeover) {
+      size_t compressed = 0;
+      auto begin = std::chrono::steady_clock::now();
+      for (int round = 0; round < kRounds; ++round) {
+        for (const auto& messages : connections) {
+          if (takeover) {
+            DeflateWithTakeover(messages, bits, &compressed);
+            continue;
+          }
+          std::string out;
+          for (const auto& message : messages) {
+            DeflateMessage(message, bits, &out);
+            compressed += out.size();
+          }
+        }
+      }
+      double us = std::chrono::duration<double, std::micro>(
+                      std::chrono::steady_clock::now() - begin)
+                      .count();
+      double sent_num = static_cast<double>(message_num) * kRounds;
+      std::printf("%-7d %-9s %8.3f %8.0f %12.2f %10.1f\n", bits,
+                  takeover ? "yes" : "no",
+                  static_cast<double>(compressed) / (raw * kRounds),
+                  compressed / sent_num, us / sent_num, raw * kRounds / us);
+    }
+  }
+
+  size_t compressed = 0;
+  auto begin = std::chrono::steady_clock::now();
+  for (int round = 0; round < kRounds; ++round) {
+    std::string out;
+    for (const auto& messages : connections) {
+      for (const auto& message : messages) {
+        DeflateWithSdpDictionary(message, kSdpDictionaryVersion, &out);
+        compressed += out.size();
+      }
+    }
+  }
+  double us = std::chrono::duration<double, std::micro>(
+                  std::chrono::steady_clock::now() - begin)
+                  .count();
+  double sent_num = static_cast<double>(message_num) * kRounds;
+  std::printf("dict v%d %-9s %8.3f %8.0f %12.2f %10.1f\n",
+              kSdpDictionaryVersion, "no",
+              static_cast<double>(compressed) / (raw * kRounds),
+              compressed / sent_num, us / sent_num, raw * kRounds / us);
+  return 0;
+}
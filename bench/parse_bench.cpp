@@ -0,0 +1,106 @@
+// Front stage cost per message type: the full json DOM parse the dispatcher
+// used to run on every message, against the one pass field scan it runs now.
+
+#include <chrono>
+#include <cstdio>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <vector>
+
+#include "alloc_counter.h"
+#include "signal_message.h"
+
+using nlohmann::json;
+
+namespace {
+
+std::string MakeSdp(size_t size) {
+  std::string sdp = "v=0\r\no=- 4611731400430051336 2 IN IP4 127.0.0.1\r\n";
+  for (int i = 0; sdp.size() < size; ++i) {
+    sdp += "a=candidate:" + std::to_string(i) +
+           " 1 udp 2122260223 192.168.1." + std::to_string(i % 250) +
+           " 5" + std::to_string(1000 + i) + " typ host generation 0\r\n";
+  }
+  return sdp;
+}
+
+struct Result {
+  double ns;
+  double allocs;
+};
+
+template <typename Parse>
+Result Measure(const std::string& payload, Parse parse) {
+  const size_t kOps = 20000;
+  size_t sink = 0;
+  size_t num_before = g_alloc_num.load();
+  auto begin = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < kOps; ++i) {
+    sink += parse(payload);
+  }
+  auto end = std::chrono::steady_clock::now();
+  size_t alloc_num = g_alloc_num.load() - num_before;
+  if (0 == sink) {
+    std::printf("nothing parsed\n");
+  }
+  return {std::chrono::duration<double, std::nano>(end - begin).count() / kOps,
+          static_cast<double>(alloc_num) / kOps};
+}
+
+}  // namespace
+
+int main() {
+  std::vector<std::pair<const char*, json>> messages = {
+      {"login", {{"type", "login"}, {"user_id", "300000001"}}},
+      {"create_transmission",
+       {{"type", "create_transmission"},
+        {"transmission_id", ""},
+        {"password", "123456"},
+        {"user_id", "300000001"}}},
+      {"query_user_id_list",
+       {{"type", "query_user_id_list"},
+        {"transmission_id", "000000"},
+        {"password", "123456"}}},
+      {"leave_transmission",
+       {{"type", "leave_transmission"},
+        {"transmission_id", "000000"},
+        {"user_id", "300000002"}}},
+      {"offer",
+       {{"type", "offer"},
+        {"transmission_id", "000000"},
+        {"user_id", "300000002"},
+        {"remote_user_id", "300000001"},
+        {"sdp", MakeSdp(8192)}}},
+      {"answer",
+       {{"type", "answer"},
+        {"transmission_id", "000000"},
+        {"user_id", "300000001"},
+        {"remote_user_id", "300000002"},
+        {"sdp", MakeSdp(6144)}}},
+      {"new_candidate",
+       {{"type", "new_candidate"},
+        {"transmission_id", "000000"},
+        {"user_id", "300000002"},
+        {"remote_user_id", "300000001"},
+        {"sdp",
+         "candidate:1 1 udp 2122260223 192.168.1.2 51000 typ host "
+         "generation 0"}}},
+  };
+
+  std::printf("%-20s %7s %12s %10s %12s %10s\n", "type", "bytes", "dom ns/op",
+              "dom alloc", "scan ns/op", "scan alloc");
+  for (auto& message : messages) {
+    std::string payload = message.second.dump();
+    Result dom = Measure(payload, [](const std::string& payload) {
+      json j = json::parse(payload);
+      return j.size();
+    });
+    Result scan = Measure(payload, [](const std::string& payload) {
+      SignalFields fields;
+      return ScanSignalMessage(payload, &fields) ? fields.type.size() : 0;
+    });
+    std::printf("%-20s %7zu %12.0f %10.1f %12.0f %10.1f\n", message.first,
+                payload.size(), dom.ns, dom.allocs, scan.ns, scan.allocs);
+  }
+  return 0;
+}
@@ -0,0 +1,142 @@
+// Relays one offer the way the json DOM path does and the way the scanning
+// fast path does, and reports time and memory traffic per relayed message.
+// Every byte the DOM path copies ends up in a fresh allocation and shows in
+// the bytes allocated. The fast path copies within the receive buffer
+// instead: RewriteRemoteUserId writes the new id and, when its length
+// differs, moves the rest of the payload. Those show in the bytes moved.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <vector>
+#include <websocketpp/frame.hpp>
+
+#include "alloc_counter.h"
+#include "signal_message.h"
+
+using nlohmann::json;
+
+namespace {
+
+std::string MakeSdp(size_t size) {
+  std::string sdp =
+      "v=0\r\no=- 4611731400430051336 2 IN IP4 127.0.0.1\r\ns=-\r\nt=0 0\r\n"
+      "a=group:BUNDLE 0 1\r\na=msid-semantic: WMS stream\r\n";
+  for (int i = 0; sdp.size() < size; ++i) {
+    sdp += "a=candidate:" + std::to_string(i) +
+           " 1 udp 2122260223 192.168.1." + std::to_string(i % 250) +
+           " 5" + std::to_string(1000 + i) + " typ host generation 0\r\n";
+    sdp += "a=rtpmap:" + std::to_string(96 + i % 32) + " VP8/90000\r\n";
+    sdp += "a=fingerprint:sha-256 4A:AD:B9:B1:3F:82:18:3B:54:02:12:DF:3E:5D"
+           ":49:6B:19:E5:7C:AB:3A:1B:4E:3B:2D:1C:9F:8E:7D:6C:5B:4A\r\n";
+  }
+  return sdp;
+}
+
+// Header of an unmasked text frame, short enough to never allocate
+std::string FrameHeader(size_t size) {
+  websocketpp::frame::basic_header header(websocketpp::frame::opcode::text,
+                                          size, true, false);
+  return websocketpp::frame::prepare_header(
+      header, websocketpp::frame::extended_header(size));
+}
+
+// What on_message, send_msg and websocketpp did for an offer before. Its
+// copies all go to fresh allocations, nothing is moved in place
+size_t DomRelay(std::string& payload, size_t* /* moved */) {
+  json j = json::parse(payload);
+  std::string transmission_id = j["transmission_id"].get<std::string>();
+  std::string remote_user_id = j["remote_user_id"].get<std::string>();
+  std::string user_id = j["user_id"].get<std::string>();
+  std::string sdp = j["sdp"].get<std::string>();
+  json message = {
+      {"type", "offer"},
+      {"transmission_id", transmission_id},
+      {"remote_user_id", user_id},
+      {"sdp", sdp},
+  };
+  // send(std::string) copies into a message, prepare_data_frame copies it
+  // again into the outgoing frame
+  std::string dumped = message.dump();
+  std::string in_message(dumped);
+  std::string out_frame(in_message);
+  std::string header = FrameHeader(out_frame.size());
+  return header.size() + out_frame.size();
+}
+
+size_t FastRelay(std::string& payload, size_t* moved) {
+  SignalFields fields;
+  if (!ScanSignalMessage(payload, &fields)) {
+    std::abort();
+  }
+  // The quoted id is written in place, the tail only moves when the id
+  // changes length
+  size_t value_len = fields.user_id.size() + 2;
+  *moved += value_len;
+  if (value_len != fields.remote_user_id_len) {
+    *moved += payload.size() - fields.remote_user_id_pos -
+              fields.remote_user_id_len;
+  }
+  RewriteRemoteUserId(&payload, fields, fields.user_id);
+  std::string header = FrameHeader(payload.size());
+  return header.size() + payload.size();
+}
+
+template <typename Relay>
+void Run(const char* name, const std::string& payload, Relay relay) {
+  const size_t kBatch = 512;
+  const size_t kRounds = 40;
+  std::vector<std::string> inputs;
+  size_t sink = 0;
+  double total_ns = 0;
+  size_t alloc_num = 0;
+  size_t alloc_bytes = 0;
+  size_t moved_bytes = 0;
+
+  for (size_t round = 0; round < kRounds; ++round) {
+    // Receive buffers are filled outside the measurement, both paths get one
+    inputs.assign(kBatch, payload);
+
+    size_t num_before = g_alloc_num.load();
+    size_t bytes_before = g_alloc_bytes.load();
+    auto begin = std::chrono::steady_clock::now();
+    for (auto& input : inputs) {
+      sink += relay(input, &moved_bytes);
+    }
+    auto end = std::chrono::steady_clock::now();
+    alloc_num += g_alloc_num.load() - num_before;
+    alloc_bytes += g_alloc_bytes.load() - bytes_before;
+    total_ns += std::chrono::duration<double, std::nano>(end - begin).count();
+  }
+
+  double ops = static_cast<double>(kBatch * kRounds);
+  std::printf(
+      "%-6s %10.0f ns/op %8.1f allocs/op %10.0f bytes allocated/op "
+      "%8.0f bytes moved/op\n",
+      name, total_ns / ops, alloc_num / ops, alloc_bytes / ops,
+      moved_bytes / ops);
+  if (0 == sink) {
+    std::printf("nothing relayed\n");
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  size_t sdp_size = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 8192;
+
+  json offer = {{"type", "offer"},
+                {"transmission_id", "000000"},
+                {"user_id", "300000002"},
+                {"remote_user_id", "300000001"},
+                {"sdp", MakeSdp(sdp_size)}};
+  std::string payload = offer.dump();
+  std::printf("offer of %zu bytes, sdp of %zu bytes\n", payload.size(),
+              offer["sdp"].get_ref<const std::string&>().size());
+
+  Run("dom", payload, DomRelay);
+  Run("fast", payload, FastRelay);
+  return 0;
+}
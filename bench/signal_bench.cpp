@@ -0,0 +1,596 @@
+// Load generator for the signal server. Every session is a host and a guest
+// going through login, create_transmission, query_user_id_list, offer and
+// answer, trickled candidates both ways and leave_transmission, with browser
+// sized sdp. Sessions start at a fixed rate and are spread over the threads,
+// each thread drives its own websocketpp client and event loop.
+//
+// Reports the connection setup rate, the message throughput and the
+// percentiles of every step. Request steps are timed from sending to the
+// reply, relayed steps from one peer sending to the other receiving. The
+// exit status is 1 when sessions failed or a gate was missed, so CI can run
+// it against a local server as a regression gate.
+//
+// Usage: signal_bench [--host 127.0.0.1] [--port 9090] [--sessions 1000]
+//                     [--rate 500] [--threads 1] [--candidates 10]
+//                     [--offer-size 5000] [--answer-size 3000] [--batch]
+//                     [--timeout 60] [--max-failures 0] [--max-p99-us 0]
+//                     [--min-setup-rate 0]
+// rate is sessions started per second, 0 starts them all at once. batch logs
+// in with the new_candidates feature. max-p99-us gates the p99 of offer,
+// answer and new_candidate, min-setup-rate the connections set up per second.
+// Both gates are off at 0.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <thread>
+#include <vector>
+#include <websocketpp/client.hpp>
+#include <websocketpp/config/asio_no_tls_client.hpp>
+
+#include "metrics.h"
+
+using nlohmann::json;
+
+typedef websocketpp::client<websocketpp::config::asio_client> client;
+
+namespace {
+
+struct Options {
+  std::string host = "127.0.0.1";
+  std::string port = "9090";
+  size_t sessions = 1000;
+  double rate = 500;
+  size_t threads = 1;
+  size_t candidates = 10;
+  size_t offer_size = 5000;
+  size_t answer_size = 3000;
+  bool batch = false;
+  int timeout_s = 60;
+  size_t max_failures = 0;
+  double max_p99_us = 0;
+  double min_setup_rate = 0;
+};
+
+enum class Step : size_t {
+  kConnect = 0,
+  kLogin,
+  kCreateTransmission,
+  kQueryUserIdList,
+  kOffer,
+  kAnswer,
+  kNewCandidate,
+  kLeaveTransmission,
+  kSession,
+  kStepNum,
+};
+
+constexpr const char* kStepNames[] = {
+    "connect", "login",         "create_transmission", "query_user_id_list",
+    "offer",   "answer",        "new_candidate",       "leave_transmission",
+    "session",
+};
+static_assert(sizeof(kStepNames) / sizeof(kStepNames[0]) ==
+                  static_cast<size_t>(Step::kStepNum),
+              "Every step needs a name");
+
+constexpr char kPassword[] = "bench";
+
+std::string MakeSdp(size_t size, size_t seed) {
+  std::string sdp =
+      "v=0\r\no=- " + std::to_string(4611731400430051336 + seed) +
+      " 2 IN IP4 127.0.0.1\r\ns=-\r\nt=0 0\r\na=group:BUNDLE 0 1\r\n"
+      "a=msid-semantic: WMS stream\r\n"
+      "m=video 9 UDP/TLS/RTP/SAVPF 96 97 98 99 100 101 102\r\n"
+      "c=IN IP4 0.0.0.0\r\na=rtcp:9 IN IP4 0.0.0.0\r\n"
+      "a=ice-ufrag:" +
+      std::to_string(seed % 10000) + "abc\r\na=ice-pwd:" +
+      std::to_string(seed) +
+      "0123456789abcdefghij\r\na=ice-options:trickle\r\n"
+      "a=fingerprint:sha-256 4A:AD:B9:B1:3F:82:18:3B:54:02:12:DF:3E:5D:49:6B:"
+      "19:E5:7C:AB:3A:1B:4E:3B:2D:1C:9F:8E:7D:6C:5B:4A\r\n"
+      "a=setup:actpass\r\na=mid:0\r\na=sendrecv\r\na=rtcp-mux\r\n";
+  for (int i = 0; sdp.size() < size; ++i) {
+    int payload_type = 96 + i % 32;
+    sdp += "a=rtpmap:" + std::to_string(payload_type) + " VP8/90000\r\n";
+    sdp += "a=rtcp-fb:" + std::to_string(payload_type) + " goog-remb\r\n";
+    sdp += "a=rtcp-fb:" + std::to_string(payload_type) + " nack pli\r\n";
+    sdp += "a=fmtp:" + std::to_string(payload_type) +
+           " level-asymmetry-allowed=1;packetization-mode=1;"
+           "profile-level-id=42e01f\r\n";
+  }
+  return sdp;
+}
+
+std::string MakeCandidate(size_t index, size_t seed) {
+  return "candidate:" + std::to_string(seed * 31 + index) +
+         " 1 udp 2122260223 192.168." + std::to_string(seed % 250) + "." +
+         std::to_string(index % 250) + " " +
+         std::to_string(50000 + index) +
+         " typ host generation 0 ufrag abc network-id 1";
+}
+
+void AddLatency(LatencySnapshot* snapshot, int64_t latency_ns) {
+  uint64_t value = latency_ns > 0 ? static_cast<uint64_t>(latency_ns) : 0;
+  ++snapshot->counts[LatencyHistogram::BucketIndex(value)];
+  ++snapshot->count;
+  snapshot->sum += value;
+}
+
+void MergeLatency(LatencySnapshot* into, const LatencySnapshot& from) {
+  for (size_t i = 0; i < from.counts.size(); ++i) {
+    into->counts[i] += from.counts[i];
+  }
+  into->count += from.count;
+  into->sum += from.sum;
+}
+
+struct Stats {
+  Stats() {
+    for (auto& step : steps) {
+      step.counts.resize(LatencyHistogram::kBucketNum);
+    }
+  }
+
+  LatencySnapshot steps[static_cast<size_t>(Step::kStepNum)];
+  size_t sessions_ok = 0;
+  size_t sessions_failed = 0;
+  size_t connections = 0;
+  size_t messages_sent = 0;
+  size_t messages_received = 0;
+};
+
+// Drives its share of the sessions on one thread. Both peers of a session
+// live on the same client, so nothing here needs a lock
+class Worker {
+ public:
+  Worker(const Options& options, size_t first_session, size_t session_num)
+      : options_(options),
+        first_session_(first_session),
+        session_num_(session_num),
+        offer_sdp_(MakeSdp(options.offer_size, first_session)),
+        answer_sdp_(MakeSdp(options.answer_size, first_session + 1)) {
+    client_.clear_access_channels(websocketpp::log::alevel::all);
+    client_.clear_error_channels(websocketpp::log::elevel::all);
+    client_.init_asio();
+    // Browsers do not hold back small writes, neither should the bench
+    client_.set_tcp_post_init_handler([this](websocketpp::connection_hdl hdl) {
+      websocketpp::lib::error_code ec;
+      client::connection_ptr con = client_.get_con_from_hdl(hdl, ec);
+      if (con) {
+        websocketpp::lib::asio::error_code option_ec;
+        con->get_socket().set_option(
+            websocketpp::lib::asio::ip::tcp::no_delay(true), option_ec);
+      }
+    });
+    start_timer_.reset(
+        new websocketpp::lib::asio::steady_timer(client_.get_io_service()));
+    deadline_timer_.reset(
+        new websocketpp::lib::asio::steady_timer(client_.get_io_service()));
+  }
+
+  void Run(int64_t start_ns) {
+    start_ns_ = start_ns;
+    sessions_.reserve(session_num_);
+    if (0 == session_num_) {
+      return;
+    }
+    deadline_timer_->expires_after(std::chrono::seconds(options_.timeout_s));
+    deadline_timer_->async_wait(
+        [this](const websocketpp::lib::asio::error_code& ec) {
+          if (!ec) {
+            Abort();
+          }
+        });
+    StartSessions();
+    client_.run();
+  }
+
+  const Stats& stats() const { return stats_; }
+
+ private:
+  struct Session;
+
+  struct Peer {
+    Session* session = nullptr;
+    bool host = false;
+    client::connection_ptr con;
+    std::string user_id;
+    // When the pending request went out, or the connect began
+    int64_t request_ns = 0;
+    // When every candidate to the other peer went out, by index
+    std::vector<int64_t> candidate_sent_ns;
+    size_t candidates_received = 0;
+  };
+
+  struct Session {
+    size_t index = 0;
+    std::string transmission_id;
+    Peer host;
+    Peer guest;
+    int64_t start_ns = 0;
+    int64_t offer_sent_ns = 0;
+    int64_t answer_sent_ns = 0;
+    bool finished = false;
+  };
+
+  // Starts every session whose time has come and waits for the next one
+  void StartSessions() {
+    int64_t now = Metrics::NowNs();
+    while (sessions_.size() < session_num_) {
+      size_t index = sessions_.size();
+      if (options_.rate > 0) {
+        int64_t due = start_ns_ + static_cast<int64_t>(
+                                      index * 1e9 * options_.threads /
+                                      options_.rate);
+        if (due > now) {
+          start_timer_->expires_after(std::chrono::nanoseconds(due - now));
+          start_timer_->async_wait(
+              [this](const websocketpp::lib::asio::error_code& ec) {
+                if (!ec) {
+                  StartSessions();
+                }
+              });
+          return;
+        }
+      }
+
+      sessions_.emplace_back(new Session());
+      Session* session = sessions_.back().get();
+      session->index = first_session_ + index;
+      session->transmission_id = "b" + std::to_string(session->index);
+      session->start_ns = now;
+      session->host.session = session;
+      session->host.host = true;
+      session->guest.session = session;
+      Connect(&session->host);
+    }
+  }
+
+  void Connect(Peer* peer) {
+    websocketpp::lib::error_code ec;
+    peer->con = client_.get_connection(
+        "ws://" + options_.host + ":" + options_.port, ec);
+    if (ec) {
+      Fail(peer->session, ec.message());
+      return;
+    }
+    peer->con->set_open_handler(
+        [this, peer](websocketpp::connection_hdl) { OnOpen(peer); });
+    peer->con->set_fail_handler([this, peer](websocketpp::connection_hdl) {
+      Fail(peer->session, peer->con->get_ec().message());
+    });
+    peer->con->set_close_handler([this, peer](websocketpp::connection_hdl) {
+      if (!peer->session->finished) {
+        Fail(peer->session, "closed by the server");
+      }
+    });
+    peer->con->set_message_handler(
+        [this, peer](websocketpp::connection_hdl, client::message_ptr msg) {
+          OnMessage(peer, msg);
+        });
+    peer->request_ns = Metrics::NowNs();
+    client_.connect(peer->con);
+  }
+
+  void OnOpen(Peer* peer) {
+    ++stats_.connections;
+    Record(Step::kConnect, peer->request_ns);
+    json login = {{"type", "login"}, {"user_id", ""}};
+    if (options_.batch) {
+      login["features"] = "new_candidates";
+    }
+    Send(peer, login);
+  }
+
+  void OnMessage(Peer* peer, client::message_ptr msg) {
+    ++stats_.messages_received;
+    Session* session = peer->session;
+    if (session->finished) {
+      return;
+    }
+    json message = json::parse(msg->get_payload(), nullptr, false);
+    if (message.is_discarded() || !message.contains("type")) {
+      Fail(session, "invalid message");
+      return;
+    }
+    const std::string& type = message["type"].get_ref<const std::string&>();
+    if (message.contains("status") && "success" != message["status"]) {
+      Fail(session, type + " failed");
+      return;
+    }
+
+    if ("login" == type) {
+      Record(Step::kLogin, peer->request_ns);
+      peer->user_id = message["user_id"].get<std::string>();
+      if (peer->host) {
+        Send(peer, {{"type", "create_transmission"},
+                    {"transmission_id", session->transmission_id},
+                    {"password", kPassword},
+                    {"user_id", peer->user_id}});
+      } else {
+        Send(peer, {{"type", "query_user_id_list"},
+                    {"transmission_id", session->transmission_id},
+                    {"password", kPassword}});
+      }
+    } else if ("transmission_id" == type) {
+      Record(Step::kCreateTransmission, peer->request_ns);
+      Connect(&session->guest);
+    } else if ("user_id_list" == type) {
+      Record(Step::kQueryUserIdList, peer->request_ns);
+      session->offer_sent_ns = Metrics::NowNs();
+      Send(peer, {{"type", "offer"},
+                  {"transmission_id", session->transmission_id},
+                  {"user_id", peer->user_id},
+                  {"remote_user_id", session->host.user_id},
+                  {"sdp", offer_sdp_}});
+    } else if ("offer" == type) {
+      Record(Step::kOffer, session->offer_sent_ns);
+      session->answer_sent_ns = Metrics::NowNs();
+      Send(peer, {{"type", "answer"},
+                  {"transmission_id", session->transmission_id},
+                  {"user_id", peer->user_id},
+                  {"remote_user_id", session->guest.user_id},
+                  {"sdp", answer_sdp_}});
+      SendCandidates(peer, &session->guest);
+    } else if ("answer" == type) {
+      Record(Step::kAnswer, session->answer_sent_ns);
+      SendCandidates(peer, &session->host);
+    } else if ("new_candidate" == type) {
+      OnCandidate(peer);
+    } else if ("new_candidates" == type) {
+      for (size_t i = 0; i < message["candidates"].size(); ++i) {
+        OnCandidate(peer);
+      }
+    } else if ("user_leave_transmission" == type) {
+      Record(Step::kLeaveTransmission, session->guest.request_ns);
+      Send(peer, {{"type", "leave_transmission"},
+                  {"transmission_id", session->transmission_id},
+                  {"user_id", peer->user_id}});
+      Finish(session);
+    }
+  }
+
+  void SendCandidates(Peer* from, Peer* to) {
+    for (size_t i = 0; i < options_.candidates; ++i) {
+      from->candidate_sent_ns.push_back(Metrics::NowNs());
+      Send(from, {{"type", "new_candidate"},
+                  {"transmission_id", from->session->transmission_id},
+                  {"user_id", from->user_id},
+                  {"remote_user_id", to->user_id},
+                  {"sdp", MakeCandidate(i, from->session->index)}});
+    }
+  }
+
+  // Candidates of a connection are relayed in order, the nth one received
+  // is the nth one the other peer sent
+  void OnCandidate(Peer* peer) {
+    Session* session = peer->session;
+    Peer* from = peer->host ? &session->guest : &session->host;
+    if (peer->candidates_received >= from->candidate_sent_ns.size()) {
+      Fail(session, "unexpected candidate");
+      return;
+    }
+    Record(Step::kNewCandidate,
+           from->candidate_sent_ns[peer->candidates_received++]);
+
+    // Once both sides have every candidate the guest leaves, the host hears
+    // of it and leaves too
+    if (session->host.candidates_received == options_.candidates &&
+        session->guest.candidates_received == options_.candidates) {
+      Send(&session->guest, {{"type", "leave_transmission"},
+                             {"transmission_id", session->transmission_id},
+                             {"user_id", session->guest.user_id}});
+    }
+  }
+
+  void Send(Peer* peer, const json& message) {
+    ++stats_.messages_sent;
+    peer->request_ns = Metrics::NowNs();
+    websocketpp::lib::error_code ec;
+    client_.send(peer->con->get_handle(), message.dump(),
+                 websocketpp::frame::opcode::text, ec);
+    if (ec) {
+      Fail(peer->session, ec.message());
+    }
+  }
+
+  void Record(Step step, int64_t since_ns) {
+    AddLatency(&stats_.steps[static_cast<size_t>(step)],
+               Metrics::NowNs() - since_ns);
+  }
+
+  void Finish(Session* session) {
+    Record(Step::kSession, session->start_ns);
+    ++stats_.sessions_ok;
+    End(session);
+  }
+
+  void Fail(Session* session, const std::string& reason) {
+    if (session->finished) {
+      return;
+    }
+    if (0 == stats_.sessions_failed) {
+      std::fprintf(stderr, "session %zu failed: %s\n", session->index,
+                   reason.c_str());
+    }
+    ++stats_.sessions_failed;
+    End(session);
+  }
+
+  void End(Session* session) {
+    session->finished = true;
+    for (Peer* peer : {&session->host, &session->guest}) {
+      if (peer->con && websocketpp::session::state::open ==
+                           peer->con->get_state()) {
+        websocketpp::lib::error_code ec;
+        peer->con->close(websocketpp::close::status::normal, "", ec);
+      }
+    }
+    if (stats_.sessions_ok + stats_.sessions_failed == session_num_) {
+      deadline_timer_->cancel();
+    }
+  }
+
+  // Sessions still running when the deadline passes count as failed
+  void Abort() {
+    start_timer_->cancel();
+    for (auto& session : sessions_) {
+      Fail(session.get(), "timed out");
+    }
+    stats_.sessions_failed += session_num_ - sessions_.size();
+    client_.get_io_service().stop();
+  }
+
+ private:
+  const Options& options_;
+  const size_t first_session_;
+  const size_t session_num_;
+  const std::string offer_sdp_;
+  const std::string answer_sdp_;
+  client client_;
+  std::unique_ptr<websocketpp::lib::asio::steady_timer> start_timer_;
+  std::unique_ptr<websocketpp::lib::asio::steady_timer> deadline_timer_;
+  int64_t start_ns_ = 0;
+  std::vector<std::unique_ptr<Session>> sessions_;
+  Stats stats_;
+};
+
+bool ParseOptions(int argc, char* argv[], Options* options) {
+  for (int i = 1; i < argc; ++i) {
+    std::string name = argv[i];
+    if ("--batch" == name) {
+      options->batch = true;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      return false;
+    }
+    const char* value = argv[++i];
+    if ("--host" == name) {
+      options->host = value;
+    } else if ("--port" == name) {
+      options->port = value;
+    } else if ("--sessions" == name) {
+      options->sessions = std::strtoul(value, nullptr, 10);
+    } else if ("--rate" == name) {
+      options->rate = std::strtod(value, nullptr);
+    } else if ("--threads" == name) {
+      options->threads = std::max<size_t>(1, std::strtoul(value, nullptr, 10));
+    } else if ("--candidates" == name) {
+      options->candidates = std::strtoul(value, nullptr, 10);
+    } else if ("--offer-size" == name) {
+      options->offer_size = std::strtoul(value, nullptr, 10);
+    } else if ("--answer-size" == name) {
+      options->answer_size = std::strtoul(value, nullptr, 10);
+    } else if ("--timeout" == name) {
+      options->timeout_s = std::atoi(value);
+    } else if ("--max-failures" == name) {
+      options->max_failures = std::strtoul(value, nullptr, 10);
+    } else if ("--max-p99-us" == name) {
+      options->max_p99_us = std::strtod(value, nullptr);
+    } else if ("--min-setup-rate" == name) {
+      options->min_setup_rate = std::strtod(value, nullptr);
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  Options options;
+  if (!ParseOptions(argc, argv, &options)) {
+    std::fprintf(stderr,
+                 "Usage: signal_bench [--host 127.0.0.1] [--port 9090] "
+                 "[--sessions 1000] [--rate 500] [--threads 1] "
+                 "[--candidates 10] [--offer-size 5000] "
+                 "[--answer-size 3000] [--batch] [--timeout 60] "
+                 "[--max-failures 0] [--max-p99-us 0] "
+                 "[--min-setup-rate 0]\n");
+    return 1;
+  }
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  size_t first_session = 0;
+  for (size_t i = 0; i < options.threads; ++i) {
+    size_t session_num = options.sessions / options.threads +
+                         (i < options.sessions % options.threads ? 1 : 0);
+    workers.emplace_back(new Worker(options, first_session, session_num));
+    first_session += session_num;
+  }
+
+  int64_t start_ns = Metrics::NowNs();
+  std::vector<std::thread> threads;
+  for (auto& worker : workers) {
+    Worker* w = worker.get();
+    threads.emplace_back([w, start_ns]() { w->Run(start_ns); });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  double seconds = (Metrics::NowNs() - start_ns) / 1e9;
+
+  Stats total;
+  for (const auto& worker : workers) {
+    const Stats& stats = worker->stats();
+    for (size_t step = 0; step < static_cast<size_t>(Step::kStepNum);
+         ++step) {
+      MergeLatency(&total.steps[step], stats.steps[step]);
+    }
+    total.sessions_ok += stats.sessions_ok;
+    total.sessions_failed += stats.sessions_failed;
+    total.connections += stats.connections;
+    total.messages_sent += stats.messages_sent;
+    total.messages_received += stats.messages_received;
+  }
+
+  double setup_rate = total.connections / seconds;
+  std::printf("%zu threads, %zu sessions in %.2f s: %zu ok, %zu failed\n",
+              options.threads, options.sessions, seconds, total.sessions_ok,
+              total.sessions_failed);
+  std::printf("%zu connections, %.1f set up/s\n", total.connections,
+              setup_rate);
+  std::printf("%zu messages sent, %zu received, %.1f msg/s\n",
+              total.messages_sent, total.messages_received,
+              (total.messages_sent + total.messages_received) / seconds);
+  std::printf("%-20s %8s %10s %10s %10s\n", "step", "count", "p50 us",
+              "p99 us", "p999 us");
+  for (size_t step = 0; step < static_cast<size_t>(Step::kStepNum); ++step) {
+    const LatencySnapshot& latency = total.steps[step];
+    std::printf("%-20s %8llu %10.1f %10.1f %10.1f\n", kStepNames[step],
+                static_cast<unsigned long long>(latency.count),
+                latency.Percentile(0.5) / 1e3, latency.Percentile(0.99) / 1e3,
+                latency.Percentile(0.999) / 1e3);
+  }
+
+  bool pass = total.sessions_failed <= options.max_failures;
+  if (!pass) {
+    std::printf("FAIL: %zu sessions failed, at most %zu allowed\n",
+                total.sessions_failed, options.max_failures);
+  }
+  if (options.max_p99_us > 0) {
+    for (Step step : {Step::kOffer, Step::kAnswer, Step::kNewCandidate}) {
+      double p99_us =
+          total.steps[static_cast<size_t>(step)].Percentile(0.99) / 1e3;
+      if (p99_us > options.max_p99_us) {
+        std::printf("FAIL: %s p99 of %.1f us is above %.1f us\n",
+                    kStepNames[static_cast<size_t>(step)], p99_us,
+                    options.max_p99_us);
+        pass = false;
+      }
+    }
+  }
+  if (options.min_setup_rate > 0 && setup_rate < options.min_setup_rate) {
+    std::printf("FAIL: %.1f connections set up/s is below %.1f\n",
+                setup_rate, options.min_setup_rate);
+    pass = false;
+  }
+  return pass ? 0 : 1;
+}
@@ -0,0 +1,237 @@
+// Cost of every TransmissionManager operation on the signaling paths, with
+// the manager holding 1k to 1M transmissions. Guest counts follow what
+// signaling sees: most transmissions have one guest, some none, a few are
+// large. Every operation runs on a random sample of the population, so
+// caches see the spread a busy server does, and reports time and heap
+// allocations per call.
+//
+// Usage: transmission_bench [session_num...]
+// Logging is compiled out of the target, so the numbers are the containers
+// alone. CheckConsistency walks every list on each change in builds without
+// NDEBUG, measure release builds.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "alloc_counter.h"
+#include "id_interner.h"
+#include "transmission_manager.h"
+
+namespace {
+
+// Operations per measurement, or the population when that is smaller
+constexpr size_t kSampleNum = 20000;
+
+constexpr char kPassword[] = "123456";
+
+struct GuestNumWeight {
+  size_t min;
+  size_t max;
+  // Percent of transmissions
+  unsigned int weight;
+};
+
+constexpr GuestNumWeight kGuestNumWeights[] = {
+    {0, 0, 20}, {1, 1, 60}, {2, 2, 10}, {3, 4, 6}, {5, 16, 3}, {17, 64, 1},
+};
+
+struct Guest {
+  id_handle user_id;
+  size_t transmission;
+};
+
+// Users and the transmissions they are bound to, the way a server with
+// session_num transmissions holds them
+struct Population {
+  std::vector<id_handle> transmissions;
+  // hosts[i] hosts transmissions[i]
+  std::vector<id_handle> hosts;
+  std::vector<Guest> guests;
+  // Stand ins for the websocketpp connections, one per user
+  std::vector<std::shared_ptr<void>> host_connections;
+  std::vector<std::shared_ptr<void>> guest_connections;
+};
+
+Population MakePopulation(size_t session_num, std::mt19937* rng) {
+  Population population;
+  std::uniform_int_distribution<unsigned int> percent(0, 99);
+  uint64_t next_user = 300000000;
+  for (size_t i = 0; i < session_num; ++i) {
+    population.transmissions.push_back(
+        InternId(std::to_string(100000000 + i)));
+    population.hosts.push_back(InternId(std::to_string(next_user++)));
+    population.host_connections.push_back(std::make_shared<int>(0));
+
+    unsigned int roll = percent(*rng);
+    const GuestNumWeight* bucket = &kGuestNumWeights[0];
+    for (const auto& weight : kGuestNumWeights) {
+      bucket = &weight;
+      if (roll < weight.weight) {
+        break;
+      }
+      roll -= weight.weight;
+    }
+    size_t guest_num = std::uniform_int_distribution<size_t>(
+        bucket->min, bucket->max)(*rng);
+    for (size_t j = 0; j < guest_num; ++j) {
+      population.guests.push_back(
+          {InternId(std::to_string(next_user++)), i});
+      population.guest_connections.push_back(std::make_shared<int>(0));
+    }
+  }
+  return population;
+}
+
+void Populate(const Population& population, TransmissionManager* manager) {
+  for (size_t i = 0; i < population.transmissions.size(); ++i) {
+    manager->BindUserToWsHandle(population.hosts[i],
+                                population.host_connections[i]);
+    manager->BindHostToTransmission(population.hosts[i],
+                                    population.transmissions[i]);
+    manager->BindPasswordToTransmission(kPassword,
+                                        population.transmissions[i]);
+  }
+  for (size_t i = 0; i < population.guests.size(); ++i) {
+    const Guest& guest = population.guests[i];
+    manager->BindUserToWsHandle(guest.user_id,
+                                population.guest_connections[i]);
+    manager->BindGuestToTransmission(
+        guest.user_id, population.transmissions[guest.transmission]);
+  }
+}
+
+// Random indexes below num, at most kSampleNum of them, without repeats
+std::vector<size_t> Sample(size_t num, std::mt19937* rng) {
+  std::vector<size_t> indexes(num);
+  for (size_t i = 0; i < num; ++i) {
+    indexes[i] = i;
+  }
+  std::shuffle(indexes.begin(), indexes.end(), *rng);
+  indexes.resize(std::min(num, kSampleNum));
+  return indexes;
+}
+
+// Runs op on every index and prints time and allocations per call
+template <typename Op>
+void Measure(const char* name, const std::vector<size_t>& indexes, Op op) {
+  if (indexes.empty()) {
+    return;
+  }
+  size_t sink = 0;
+  size_t num_before = g_alloc_num.load();
+  auto begin = std::chrono::steady_clock::now();
+  for (size_t index : indexes) {
+    sink += op(index);
+  }
+  auto end = std::chrono::steady_clock::now();
+  size_t alloc_num = g_alloc_num.load() - num_before;
+  double ops = static_cast<double>(indexes.size());
+  std::printf("%-30s %10.1f %10.2f\n", name,
+              std::chrono::duration<double, std::nano>(end - begin).count() /
+                  ops,
+              alloc_num / ops);
+  if (0 == sink) {
+    std::printf("%-30s did nothing\n", name);
+  }
+}
+
+void Run(size_t session_num, std::mt19937* rng) {
+  Population population = MakePopulation(session_num, rng);
+  TransmissionManager manager;
+  Populate(population, &manager);
+  std::printf("\n%zu transmissions, %zu guests\n", session_num,
+              population.guests.size());
+  std::printf("%-30s %10s %10s\n", "operation", "ns/op", "allocs/op");
+
+  std::vector<size_t> transmissions =
+      Sample(population.transmissions.size(), rng);
+  std::vector<size_t> guests = Sample(population.guests.size(), rng);
+
+  Measure("IsGuest", guests, [&](size_t i) {
+    return kInvalidId != manager.IsGuest(population.guests[i].user_id);
+  });
+  Measure("IsHost", transmissions, [&](size_t i) {
+    return kInvalidId != manager.IsHost(population.hosts[i]);
+  });
+  Measure("GetWsHandle", guests, [&](size_t i) {
+    return !manager.GetWsHandle(population.guests[i].user_id).expired();
+  });
+  Measure("GetAllUserIdOfTransmission", transmissions, [&](size_t i) {
+    return manager.GetAllUserIdOfTransmission(population.transmissions[i])
+        .size();
+  });
+  Measure("GetAllMemberOfTransmission", transmissions, [&](size_t i) {
+    return manager.GetAllMemberOfTransmission(population.transmissions[i])
+        .size();
+  });
+  Measure("CheckPassword", transmissions, [&](size_t i) {
+    return 0 == manager.CheckPassword(kPassword, population.transmissions[i]);
+  });
+
+  // Each release is followed by the bind that undoes it, so the population
+  // is the same for every operation
+  Measure("ReleaseGuestFromTransmission", guests, [&](size_t i) {
+    return manager.ReleaseGuestFromTransmission(population.guests[i].user_id);
+  });
+  Measure("BindGuestToTransmission", guests, [&](size_t i) {
+    const Guest& guest = population.guests[i];
+    return manager.BindGuestToTransmission(
+        guest.user_id, population.transmissions[guest.transmission]);
+  });
+
+  Measure("ReleaseUserFromeWsHandle", guests, [&](size_t i) {
+    return kInvalidId !=
+           manager.ReleaseUserFromeWsHandle(population.guest_connections[i]);
+  });
+  Measure("BindUserToWsHandle", guests, [&](size_t i) {
+    return manager.BindUserToWsHandle(population.guests[i].user_id,
+                                      population.guest_connections[i]);
+  });
+
+  // Releasing a transmission drops its guests too, they are bound again
+  // outside the measurement
+  Measure("ReleaseTransmission", transmissions, [&](size_t i) {
+    return manager.ReleaseTransmission(population.transmissions[i]);
+  });
+  Measure("BindHostToTransmission", transmissions, [&](size_t i) {
+    return manager.BindHostToTransmission(population.hosts[i],
+                                          population.transmissions[i]);
+  });
+  for (size_t i : transmissions) {
+    manager.BindPasswordToTransmission(kPassword, population.transmissions[i]);
+  }
+  for (const Guest& guest : population.guests) {
+    if (kInvalidId == manager.IsGuest(guest.user_id)) {
+      manager.BindGuestToTransmission(
+          guest.user_id, population.transmissions[guest.transmission]);
+    }
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+#ifndef NDEBUG
+  std::printf(
+      "Built without NDEBUG, every change walks all lists to check them\n");
+#endif
+  std::vector<size_t> session_nums;
+  for (int i = 1; i < argc; ++i) {
+    session_nums.push_back(std::strtoul(argv[i], nullptr, 10));
+  }
+  if (session_nums.empty()) {
+    session_nums = {1000, 10000, 100000, 1000000};
+  }
+
+  std::mt19937 rng(42);
+  for (size_t session_num : session_nums) {
+    Run(session_num, &rng);
+  }
+  return 0;
+}
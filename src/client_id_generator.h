@@ -7,6 +7,7 @@
 #ifndef _CLIENT_ID_GENERATOR_H_
 #define _CLIENT_ID_GENERATOR_H_
 
+#include <atomic>
 #include <iostream>
 #include <string>
 
@@ -19,7 +20,7 @@ class ClientIdGenerator {
   std::string GeneratorNewId();
 
  private:
-  int base_id_ = 300000000;
+  std::atomic<int> base_id_{300000000};
 };
 
 #endif
\ No newline at end of file
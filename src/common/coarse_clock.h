@@ -0,0 +1,59 @@
+#ifndef _COARSE_CLOCK_H_
+#define _COARSE_CLOCK_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Process wide monotonic clock in milliseconds. Reading it is one relaxed
+// atomic load, the event loop refreshes it every few milliseconds with
+// Update(), so Now() lags the real clock by at most one refresh period while
+// a loop is running. It never goes backwards, wall clock steps do not affect
+// it. WallNow() is the wall clock refreshed alongside, for timestamps that
+// are read by people and other hosts.
+//
+// Millisecond stamps only, anything timed below the refresh period, like the
+// relay latency histograms, reads Metrics::NowNs() instead.
+class CoarseClock {
+ public:
+  // How often the event loop is expected to call Update
+  static constexpr std::chrono::milliseconds kResolution{4};
+
+  static int64_t Now() { return now_.load(std::memory_order_relaxed); }
+
+  // Milliseconds since the epoch as of the last Update, may step with the
+  // wall clock
+  static int64_t WallNow() {
+    return wall_now_.load(std::memory_order_relaxed);
+  }
+
+  // Reads the steady clock and publishes it, returns the precise time. Safe
+  // to call from several threads, the published time only moves forward
+  static int64_t Update() {
+    wall_now_.store(ReadWallClock(), std::memory_order_relaxed);
+    int64_t now = ReadClock();
+    int64_t last = now_.load(std::memory_order_relaxed);
+    while (last < now && !now_.compare_exchange_weak(
+                             last, now, std::memory_order_relaxed)) {
+    }
+    return now;
+  }
+
+ private:
+  static int64_t ReadClock() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  static int64_t ReadWallClock() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+  }
+
+  inline static std::atomic<int64_t> now_{ReadClock()};
+  inline static std::atomic<int64_t> wall_now_{ReadWallClock()};
+};
+
+#endif
@@ -1,35 +1,95 @@
 #ifndef _COMMON_H_
 #define _COMMON_H_
 
+#include <cstdint>
 #include <iostream>
+#include <string_view>
 
 int CommonDummy();
 
-constexpr size_t HASH_STRING_PIECE(const char *string_piece) {
-  std::size_t result = 0;
-  while (*string_piece) {
-    result = (result * 131) + *string_piece++;
+template <typename Value>
+struct PerfectHashEntry {
+  std::string_view key;
+  Value value;
+};
+
+// Seeded FNV-1a, the seed is searched for by PerfectHashMap
+constexpr uint64_t PERFECT_HASH(std::string_view key, uint64_t seed) {
+  uint64_t result = 14695981039346656037ULL ^ (seed * 0x9E3779B97F4A7C15ULL);
+  for (char c : key) {
+    result ^= static_cast<unsigned char>(c);
+    result *= 1099511628211ULL;
   }
-  return result;
+  return result ^ (result >> 29);
 }
 
-constexpr size_t operator"" _H(const char *string_piece, size_t) {
-  return HASH_STRING_PIECE(string_piece);
-}
+// Read only map over a fixed set of string keys, built at compile time. The
+// constructor searches for a hash seed that gives every key a slot of its
+// own, so a lookup is one hash, one slot load and one full key compare.
+// Valid() is false when no such seed exists, which includes duplicate keys,
+// callers static_assert on it.
+template <typename Value, size_t N>
+class PerfectHashMap {
+ public:
+  static constexpr size_t SlotNum() {
+    size_t slot_num = 1;
+    while (slot_num < 2 * N) {
+      slot_num <<= 1;
+    }
+    return slot_num;
+  }
+
+  constexpr explicit PerfectHashMap(
+      const PerfectHashEntry<Value> (&entries)[N]) {
+    for (size_t i = 0; i < N; ++i) {
+      entries_[i] = entries[i];
+    }
+    for (uint64_t seed = 0; seed < 4096; ++seed) {
+      if (TrySeed(seed)) {
+        seed_ = seed;
+        valid_ = true;
+        return;
+      }
+    }
+  }
 
-inline const std::string GetIceUsername(const std::string &sdp) {
-  std::string result = "";
+  constexpr bool Valid() const { return valid_; }
 
-  std::string start = "ice-ufrag:";
-  std::string end = "\r\n";
-  size_t startPos = sdp.find(start);
-  size_t endPos = sdp.find(end);
+  constexpr const Value *Find(std::string_view key) const {
+    size_t slot = slots_[PERFECT_HASH(key, seed_) & (SlotNum() - 1)];
+    if (0 != slot && entries_[slot - 1].key == key) {
+      return &entries_[slot - 1].value;
+    }
+    return nullptr;
+  }
 
-  if (startPos != std::string::npos && endPos != std::string::npos) {
-    result = sdp.substr(startPos + start.length(),
-                        endPos - startPos - start.length());
+ private:
+  constexpr bool TrySeed(uint64_t seed) {
+    for (auto &slot : slots_) {
+      slot = 0;
+    }
+    for (size_t i = 0; i < N; ++i) {
+      size_t index = PERFECT_HASH(entries_[i].key, seed) & (SlotNum() - 1);
+      auto &slot = slots_[index];
+      if (0 != slot) {
+        return false;
+      }
+      slot = static_cast<uint32_t>(i + 1);
+    }
+    return true;
   }
-  return result;
+
+  PerfectHashEntry<Value> entries_[N] = {};
+  // Index into entries_ plus one, zero for an empty slot
+  uint32_t slots_[SlotNum()] = {};
+  uint64_t seed_ = 0;
+  bool valid_ = false;
+};
+
+template <typename Value, size_t N>
+constexpr PerfectHashMap<Value, N> MakePerfectHashMap(
+    const PerfectHashEntry<Value> (&entries)[N]) {
+  return PerfectHashMap<Value, N>(entries);
 }
 
 #endif
\ No newline at end of file
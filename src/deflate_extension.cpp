@@ -0,0 +1,91 @@
+#include "deflate_extension.h"
+
+#include <zlib.h>
+
+#include <memory>
+
+void DeflateBudget::SetOptions(const DeflateOptions& options) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  options_ = options;
+}
+
+DeflateOptions DeflateBudget::Options() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return options_;
+}
+
+bool DeflateBudget::Acquire() {
+  size_t max_contexts = Options().max_contexts;
+  size_t active = active_.load(std::memory_order_relaxed);
+  while (active < max_contexts) {
+    if (active_.compare_exchange_weak(active, active + 1,
+                                      std::memory_order_relaxed)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void DeflateBudget::Release() {
+  active_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+size_t DeflateBudget::Active() {
+  return active_.load(std::memory_order_relaxed);
+}
+
+namespace {
+
+struct DeflateStream {
+  z_stream stream = {};
+  bool initialized = false;
+
+  ~DeflateStream() {
+    if (initialized) {
+      deflateEnd(&stream);
+    }
+  }
+};
+
+}  // namespace
+
+bool DeflateMessage(const std::string& in, uint8_t window_bits,
+                    std::string* out) {
+  if (window_bits < 9 || window_bits > 15) {
+    return false;
+  }
+
+  // One stream per window size and thread, reset between messages instead of
+  // paying for its allocation every time
+  thread_local std::unique_ptr<DeflateStream> streams[16];
+  std::unique_ptr<DeflateStream>& s = streams[window_bits];
+  if (!s) {
+    s.reset(new DeflateStream());
+    if (Z_OK != deflateInit2(&s->stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                             -window_bits, 8, Z_DEFAULT_STRATEGY)) {
+      s.reset();
+      return false;
+    }
+    s->initialized = true;
+  } else if (Z_OK != deflateReset(&s->stream)) {
+    return false;
+  }
+
+  out->resize(deflateBound(&s->stream, in.size()) + 16);
+  s->stream.next_in =
+      reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+  s->stream.avail_in = static_cast<uInt>(in.size());
+  s->stream.next_out = reinterpret_cast<Bytef*>(&(*out)[0]);
+  s->stream.avail_out = static_cast<uInt>(out->size());
+
+  int ret = deflate(&s->stream, Z_SYNC_FLUSH);
+  if (Z_OK != ret || 0 != s->stream.avail_in) {
+    return false;
+  }
+  size_t size = out->size() - s->stream.avail_out;
+  if (size < 4) {
+    return false;
+  }
+  out->resize(size - 4);
+  return true;
+}
@@ -0,0 +1,276 @@
+#include "event_journal.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "log.h"
+
+const char* JournalEventName(JournalEvent event) {
+  switch (event) {
+    case JournalEvent::kOpen:
+      return "open";
+    case JournalEvent::kClose:
+      return "close";
+    case JournalEvent::kIdleClose:
+      return "idle_close";
+    case JournalEvent::kLogin:
+      return "login";
+    case JournalEvent::kCreateTransmission:
+      return "create_transmission";
+    case JournalEvent::kLeaveTransmission:
+      return "leave_transmission";
+    case JournalEvent::kQueryUserIdList:
+      return "query_user_id_list";
+    case JournalEvent::kOffer:
+      return "offer";
+    case JournalEvent::kAnswer:
+      return "answer";
+    case JournalEvent::kNewCandidate:
+      return "new_candidate";
+    case JournalEvent::kCandidateBatch:
+      return "new_candidates";
+    case JournalEvent::kInvalid:
+      return "invalid";
+    default:
+      return "none";
+  }
+}
+
+void SetJournalId(char (&field)[kJournalIdSize], std::string_view id) {
+  size_t size = std::min(id.size(), kJournalIdSize);
+  std::memcpy(field, id.data(), size);
+  std::memset(field + size, 0, kJournalIdSize - size);
+}
+
+EventJournal::EventJournal(const std::string& dir, size_t records_per_file,
+                           size_t max_files)
+    : dir_(dir),
+      records_per_file_(std::max<size_t>(1, records_per_file)),
+      max_files_(std::max<size_t>(2, max_files)) {}
+
+EventJournal::~EventJournal() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  prepare_cv_.notify_one();
+  if (preparer_.joinable()) {
+    preparer_.join();
+  }
+  for (auto& segment : segments_) {
+    Unmap(segment.get());
+  }
+}
+
+std::shared_ptr<EventJournal> EventJournal::Open(const std::string& dir,
+                                                 size_t records_per_file,
+                                                 size_t max_files) {
+#ifdef __linux__
+  mkdir(dir.c_str(), 0755);
+  std::shared_ptr<EventJournal> journal(
+      new EventJournal(dir, records_per_file, max_files));
+  std::unique_ptr<Segment> segment = journal->MapSegment(0);
+  if (!segment) {
+    return nullptr;
+  }
+  journal->current_.store(segment.get(), std::memory_order_release);
+  journal->segments_.push_back(std::move(segment));
+  journal->preparer_ = std::thread(&EventJournal::Prepare, journal.get());
+  return journal;
+#else
+  LOG_WARN("Event journal is only supported on linux");
+  return nullptr;
+#endif
+}
+
+void EventJournal::Record(const JournalRecord& record) {
+  // Counted in the epoch current_ is read in, so Prepare waits for us
+  // before freeing any segment we may see. Entering is retried when the
+  // epoch moves on meanwhile, the count could come too late for the wait.
+  // Sequentially consistent along with the stores of current_ and the
+  // reads of writers_
+  size_t parity;
+  for (;;) {
+    uint64_t epoch = epoch_.load();
+    parity = epoch & 1;
+    writers_[parity].fetch_add(1);
+    if (epoch_.load() == epoch) {
+      break;
+    }
+    writers_[parity].fetch_sub(1);
+  }
+
+  for (;;) {
+    Segment* segment = current_.load();
+    if (!segment) {
+      break;
+    }
+
+    size_t pos = segment->next.fetch_add(1);
+    if (pos < segment->capacity) {
+      std::memcpy(&segment->records[pos], &record, sizeof(record));
+      break;
+    }
+    if (!Rotate(segment)) {
+      break;
+    }
+  }
+  writers_[parity].fetch_sub(1, std::memory_order_release);
+}
+
+bool EventJournal::Rotate(Segment* full) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (current_.load(std::memory_order_relaxed) != full) {
+    return true;
+  }
+
+  if (!next_) {
+    if (failed_) {
+      // Stop journaling rather than retry on every record
+      current_.store(nullptr);
+      retired_.push_back(full);
+      lock.unlock();
+      prepare_cv_.notify_one();
+    } else if (!lagging_) {
+      lagging_ = true;
+      LOG_WARN("Event journal [{}] is not mapped yet, drop records until it is",
+               sequence_ + 1);
+    }
+    return false;
+  }
+
+  ++sequence_;
+  current_.store(next_);
+  next_ = nullptr;
+  lagging_ = false;
+  retired_.push_back(full);
+  lock.unlock();
+  prepare_cv_.notify_one();
+  return true;
+}
+
+void EventJournal::Prepare() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stop_) {
+    if (!retired_.empty()) {
+      std::vector<Segment*> retired;
+      retired.swap(retired_);
+      uint64_t sequence = sequence_;
+      lock.unlock();
+
+      // Writers that entered from now on only find segments after the
+      // retired ones, wait for those that entered before to finish their
+      // copies and let go of the pointers
+      size_t parity = epoch_.fetch_add(1) & 1;
+      while (0 != writers_[parity].load()) {
+        std::this_thread::yield();
+      }
+      for (Segment* segment : retired) {
+        Unmap(segment);
+      }
+      // The file mapped next is counted too
+      for (; oldest_ + max_files_ <= sequence + 1; ++oldest_) {
+        std::string oldest =
+            dir_ + "/journal-" + std::to_string(oldest_) + ".bin";
+        std::remove(oldest.c_str());
+      }
+
+      lock.lock();
+      segments_.erase(
+          std::remove_if(segments_.begin(), segments_.end(),
+                         [&](const std::unique_ptr<Segment>& segment) {
+                           return retired.end() != std::find(retired.begin(),
+                                                             retired.end(),
+                                                             segment.get());
+                         }),
+          segments_.end());
+      continue;
+    }
+
+    if (!next_ && !failed_) {
+      // sequence_ only moves on once next_ is there
+      uint64_t sequence = sequence_ + 1;
+      lock.unlock();
+      std::unique_ptr<Segment> segment = MapSegment(sequence);
+      lock.lock();
+      if (!segment) {
+        failed_ = true;
+      } else {
+        next_ = segment.get();
+        segments_.push_back(std::move(segment));
+      }
+      continue;
+    }
+
+    prepare_cv_.wait(lock);
+  }
+}
+
+std::unique_ptr<EventJournal::Segment> EventJournal::MapSegment(
+    uint64_t sequence) {
+#ifdef __linux__
+  std::string path = dir_ + "/journal-" + std::to_string(sequence) + ".bin";
+  size_t size =
+      sizeof(JournalHeader) + records_per_file_ * sizeof(JournalRecord);
+
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    LOG_ERROR("Open event journal [{}] failed, errno [{}]", path, errno);
+    return nullptr;
+  }
+  // Allocate the blocks up front, a full disk fails here and not with a
+  // SIGBUS on some later record
+  int ret = posix_fallocate(fd, 0, size);
+  if (0 != ret) {
+    LOG_ERROR("Preallocate event journal [{}] failed, error [{}]", path, ret);
+    close(fd);
+    return nullptr;
+  }
+  // Populated here, on the background thread, so writers do not take the
+  // page faults
+  void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd, 0);
+  close(fd);
+  if (MAP_FAILED == mapping) {
+    LOG_ERROR("Map event journal [{}] failed, errno [{}]", path, errno);
+    return nullptr;
+  }
+
+  JournalHeader header = {};
+  std::memcpy(header.magic, kJournalMagic, sizeof(header.magic));
+  header.version = kJournalVersion;
+  header.record_size = sizeof(JournalRecord);
+  header.capacity = records_per_file_;
+  header.sequence = sequence;
+  std::memcpy(mapping, &header, sizeof(header));
+
+  std::unique_ptr<Segment> segment(new Segment());
+  segment->mapping = mapping;
+  segment->mapping_size = size;
+  segment->records = reinterpret_cast<JournalRecord*>(
+      static_cast<char*>(mapping) + sizeof(JournalHeader));
+  segment->capacity = records_per_file_;
+  LOG_INFO("Event journal writes to [{}]", path);
+  return segment;
+#else
+  return nullptr;
+#endif
+}
+
+void EventJournal::Unmap(Segment* segment) {
+#ifdef __linux__
+  if (segment->mapping) {
+    munmap(segment->mapping, segment->mapping_size);
+    segment->mapping = nullptr;
+  }
+#endif
+}
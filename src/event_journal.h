@@ -0,0 +1,151 @@
+#ifndef _EVENT_JOURNAL_H_
+#define _EVENT_JOURNAL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "coarse_clock.h"
+
+enum class JournalEvent : uint8_t {
+  kNone = 0,
+  kOpen,
+  kClose,
+  kIdleClose,
+  kLogin,
+  kCreateTransmission,
+  kLeaveTransmission,
+  kQueryUserIdList,
+  kOffer,
+  kAnswer,
+  kNewCandidate,
+  kCandidateBatch,
+  kInvalid,
+};
+
+const char* JournalEventName(JournalEvent event);
+
+// Ids longer than this are cut, shorter ones are padded with zeros
+constexpr size_t kJournalIdSize = 16;
+
+// One signaling event, the same size for every event so that records can be
+// claimed with a single atomic add and decoded by offset
+struct JournalRecord {
+  // Microseconds since the epoch, 0 marks a slot never written. Taken from
+  // CoarseClock::WallNow(), so only good to a few milliseconds
+  int64_t timestamp_us;
+  // From receiving the message to its handler returning
+  uint32_t latency_us;
+  // Payload bytes of the message, or of the batch
+  uint32_t size;
+  uint32_t connection;
+  JournalEvent event;
+  uint8_t reserved[3];
+  char transmission_id[kJournalIdSize];
+  char user_id[kJournalIdSize];
+  char remote_user_id[kJournalIdSize];
+};
+static_assert(sizeof(JournalRecord) == 72, "Journal records are 72 bytes");
+
+// Copies id into a record field
+void SetJournalId(char (&field)[kJournalIdSize], std::string_view id);
+
+// Header at the start of every journal file
+struct JournalHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  uint64_t capacity;
+  uint64_t sequence;
+  uint8_t reserved[32];
+};
+static_assert(sizeof(JournalHeader) == 64, "Journal headers are 64 bytes");
+
+constexpr char kJournalMagic[8] = {'S', 'I', 'G', 'J', 'R', 'N', 'L', '\0'};
+constexpr uint32_t kJournalVersion = 1;
+
+// Binary journal of signaling events. Records go to files that are
+// preallocated and mapped into memory, so writing one is an atomic add to
+// claim a slot and a copy, no lock and no system call. A background thread
+// maps the next file while the current one fills, the writer that overflows
+// the current file only swaps in the next one. The same thread unmaps and
+// frees full files and removes the oldest beyond max_files, which counts the
+// current file and the one mapped ahead. Files are named
+// journal-<sequence>.bin, see tools/journal_decode for reading them.
+class EventJournal {
+ public:
+  ~EventJournal();
+
+  // Returns nullptr when the directory or the first file cannot be set up.
+  // max_files is at least 2, the current file and the next
+  static std::shared_ptr<EventJournal> Open(const std::string& dir,
+                                            size_t records_per_file,
+                                            size_t max_files);
+
+  void Record(const JournalRecord& record);
+
+  // CoarseClock::WallNow() in microseconds, the resolution of timestamp_us
+  static int64_t NowUs() { return CoarseClock::WallNow() * 1000; }
+
+ private:
+  struct Segment {
+    JournalRecord* records = nullptr;
+    size_t capacity = 0;
+    void* mapping = nullptr;
+    size_t mapping_size = 0;
+    std::atomic<size_t> next{0};
+  };
+
+  EventJournal(const std::string& dir, size_t records_per_file,
+               size_t max_files);
+
+  std::unique_ptr<Segment> MapSegment(uint64_t sequence);
+  // Replaces full, the segment a writer overflowed, with the one mapped
+  // ahead, unless another writer did already. False when the record has to
+  // be dropped because there is nothing to replace it with
+  bool Rotate(Segment* full);
+  static void Unmap(Segment* segment);
+
+  // Body of the background thread: maps the next segment ahead, frees the
+  // retired ones and removes the files beyond max_files
+  void Prepare();
+
+ private:
+  const std::string dir_;
+  const size_t records_per_file_;
+  const size_t max_files_;
+
+  std::atomic<Segment*> current_{nullptr};
+  // Writers in Record, counted by the parity of the epoch they entered in.
+  // Prepare moves the epoch on and waits for the writers of the last one,
+  // after that none holds a pointer to a segment retired before
+  std::atomic<uint64_t> epoch_{0};
+  std::atomic<size_t> writers_[2] = {};
+
+  // Guards the members below
+  std::mutex mutex_;
+  std::condition_variable prepare_cv_;
+  // Sequence of current_
+  uint64_t sequence_ = 0;
+  // Mapped ahead by the background thread, nullptr while it is at it
+  Segment* next_ = nullptr;
+  // Full segments waiting for their writers to finish before being freed
+  std::vector<Segment*> retired_;
+  // Oldest file not removed yet
+  uint64_t oldest_ = 0;
+  // Segments not freed yet: current_, next_ and those in retirement
+  std::vector<std::unique_ptr<Segment>> segments_;
+  bool failed_ = false;
+  // Whether the drop of records for want of a next segment is logged
+  bool lagging_ = false;
+  bool stop_ = false;
+  std::thread preparer_;
+};
+
+#endif
@@ -0,0 +1,198 @@
+#include "id_interner.h"
+
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+constexpr size_t kMaxDecimalLength = 17;
+constexpr int kLengthShift = 57;
+constexpr id_handle kValueMask = (id_handle(1) << kLengthShift) - 1;
+constexpr id_handle kInternedFlag = id_handle(1) << 63;
+// Interned handles carry the slot of the id in the low 32 bits and the
+// generation of the slot above
+constexpr int kGenerationShift = 32;
+constexpr id_handle kSlotMask = (id_handle(1) << kGenerationShift) - 1;
+constexpr uint32_t kGenerationMask = 0x7fffffff;
+
+class IdTable {
+ public:
+  id_handle Find(std::string_view id) {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    auto it = index_.find(id);
+    return it != index_.end() ? it->second : kInvalidId;
+  }
+
+  id_handle Intern(std::string_view id) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    auto it = index_.find(id);
+    if (it != index_.end()) {
+      ++entries_[SlotOf(it->second)].references;
+      return it->second;
+    }
+
+    size_t slot = entries_.size();
+    if (!free_slots_.empty()) {
+      slot = free_slots_.back();
+      free_slots_.pop_back();
+    } else {
+      entries_.emplace_back();
+    }
+    // deque keeps the entries in place, index_ keys point into their names
+    Entry& entry = entries_[slot];
+    entry.name = id;
+    entry.references = 1;
+    id_handle handle = kInternedFlag |
+                       (id_handle(entry.generation) << kGenerationShift) |
+                       (slot + 1);
+    index_.emplace(entry.name, handle);
+    return handle;
+  }
+
+  bool Retain(id_handle handle) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    Entry* entry = Lookup(handle);
+    if (!entry) {
+      return false;
+    }
+    ++entry->references;
+    return true;
+  }
+
+  void Release(id_handle handle) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    Entry* entry = Lookup(handle);
+    if (!entry || 0 != --entry->references) {
+      return;
+    }
+    index_.erase(entry->name);
+    std::string().swap(entry->name);
+    // Handles of the old id must not resolve to the next one in the slot
+    entry->generation = (entry->generation + 1) & kGenerationMask;
+    free_slots_.push_back(SlotOf(handle));
+  }
+
+  size_t Size() {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return index_.size();
+  }
+
+  std::string Name(id_handle handle) {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    Entry* entry = Lookup(handle);
+    return entry ? entry->name : "";
+  }
+
+ private:
+  struct Entry {
+    std::string name;
+    uint32_t generation = 0;
+    uint32_t references = 0;
+  };
+
+  static size_t SlotOf(id_handle handle) {
+    return static_cast<size_t>(handle & kSlotMask) - 1;
+  }
+
+  // Callers must hold mutex_
+  Entry* Lookup(id_handle handle) {
+    size_t slot = SlotOf(handle);
+    if (!(handle & kInternedFlag) || slot >= entries_.size()) {
+      return nullptr;
+    }
+    Entry& entry = entries_[slot];
+    uint32_t generation = static_cast<uint32_t>(
+        (handle & ~kInternedFlag) >> kGenerationShift);
+    return 0 != entry.references && generation == entry.generation
+               ? &entry
+               : nullptr;
+  }
+
+ private:
+  std::shared_mutex mutex_;
+  std::deque<Entry> entries_;
+  std::vector<size_t> free_slots_;
+  std::unordered_map<std::string_view, id_handle> index_;
+};
+
+IdTable& GetIdTable() {
+  static IdTable table;
+  return table;
+}
+
+// Encodes decimal ids without touching the table, false for anything else
+bool EncodeDecimal(std::string_view id, id_handle* handle) {
+  if (id.empty() || id.size() > kMaxDecimalLength) {
+    return false;
+  }
+
+  id_handle value = 0;
+  for (char c : id) {
+    if (c < '0' || c > '9') {
+      return false;
+    }
+    value = value * 10 + (c - '0');
+  }
+
+  *handle = (id_handle(id.size()) << kLengthShift) | value;
+  return true;
+}
+}  // namespace
+
+id_handle InternId(std::string_view id) {
+  id_handle handle = kInvalidId;
+  if (id.empty() || EncodeDecimal(id, &handle)) {
+    return handle;
+  }
+  return GetIdTable().Intern(id);
+}
+
+id_handle FindId(std::string_view id) {
+  id_handle handle = kInvalidId;
+  if (id.empty() || EncodeDecimal(id, &handle)) {
+    return handle;
+  }
+  return GetIdTable().Find(id);
+}
+
+void RetainId(id_handle id) {
+  if (id & kInternedFlag) {
+    GetIdTable().Retain(id);
+  }
+}
+
+bool TryRetainId(id_handle id) {
+  if (kInvalidId == id) {
+    return false;
+  }
+  return !(id & kInternedFlag) || GetIdTable().Retain(id);
+}
+
+void ReleaseId(id_handle id) {
+  if (id & kInternedFlag) {
+    GetIdTable().Release(id);
+  }
+}
+
+size_t InternedIdNum() { return GetIdTable().Size(); }
+
+std::string IdToString(id_handle id) {
+  if (kInvalidId == id) {
+    return "";
+  }
+
+  if (id & kInternedFlag) {
+    return GetIdTable().Name(id);
+  }
+
+  size_t length = static_cast<size_t>(id >> kLengthShift);
+  id_handle value = id & kValueMask;
+  std::string result(length, '0');
+  for (size_t i = length; i > 0 && value; --i) {
+    result[i - 1] = static_cast<char>('0' + value % 10);
+    value /= 10;
+  }
+  return result;
+}
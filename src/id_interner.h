@@ -0,0 +1,60 @@
+#ifndef _ID_INTERNER_H_
+#define _ID_INTERNER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// User and transmission ids stay strings on the wire but are handled as
+// 64-bit handles inside the server. Decimal ids of up to 17 digits, which is
+// what ClientIdGenerator and GenerateTransmissionId produce, are encoded in
+// the handle itself together with their length, so leading zeros survive.
+// Any other id is interned into a process wide table and gets a handle with
+// the top bit set. Interned ids are reference counted, the entry goes away
+// with the last reference and the handles it gave out stop resolving, so ids
+// that clients make up do not pile up in the table.
+typedef uint64_t id_handle;
+
+// Handle of the empty id, also returned for ids that are not known
+constexpr id_handle kInvalidId = 0;
+
+// Returns the handle of id, interning it when needed. The caller owns a
+// reference, given back with ReleaseId
+id_handle InternId(std::string_view id);
+
+// Like InternId but never grows the table and takes no reference, unknown ids
+// map to kInvalidId
+id_handle FindId(std::string_view id);
+
+// Reference counting of interned handles, no-ops for the others. RetainId
+// is for handles the caller holds a reference to
+void RetainId(id_handle id);
+void ReleaseId(id_handle id);
+
+// RetainId for handles held without a reference, such as those of FindId,
+// whose id may have been released meanwhile. False when it was, or for
+// kInvalidId, no reference is taken then
+bool TryRetainId(id_handle id);
+
+// Number of ids in the table
+size_t InternedIdNum();
+
+std::string IdToString(id_handle id);
+
+// Interns id for the scope, long enough for whoever binds it to take its own
+// reference
+class ScopedId {
+ public:
+  explicit ScopedId(std::string_view id) : handle_(InternId(id)) {}
+  ~ScopedId() { ReleaseId(handle_); }
+  ScopedId(const ScopedId&) = delete;
+  ScopedId& operator=(const ScopedId&) = delete;
+
+  id_handle get() const { return handle_; }
+
+ private:
+  id_handle handle_;
+};
+
+#endif
@@ -0,0 +1,247 @@
+#ifndef _ASYNC_LOG_SINK_H_
+#define _ASYNC_LOG_SINK_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "spdlog/details/log_msg_buffer.h"
+#include "spdlog/sinks/sink.h"
+
+// What a full queue does to the thread that logs
+enum class LogOverflowPolicy {
+  // Wait for the writer to make room, nothing is lost
+  kBlock,
+  // Discard the record
+  kDrop,
+  // Discard the record and have the writer report how many were discarded
+  kDropAndCount,
+};
+
+// Sink that hands records to a writer thread through a bounded lock free
+// ring, the writer formats them into the wrapped sinks. Logging threads only
+// copy the record into a slot, they never touch a file or wait for a flush.
+// The writer flushes the wrapped sinks once per flush interval and right
+// after critical records.
+class AsyncLogSink : public spdlog::sinks::sink {
+ public:
+  // queue_size is rounded up to a power of two
+  AsyncLogSink(std::vector<spdlog::sink_ptr> sinks, size_t queue_size,
+               LogOverflowPolicy policy,
+               std::chrono::milliseconds flush_interval)
+      : sinks_(std::move(sinks)),
+        policy_(policy),
+        flush_interval_(flush_interval) {
+    size_t capacity = 2;
+    while (capacity < queue_size) {
+      capacity <<= 1;
+    }
+    slots_.reset(new Slot[capacity]);
+    mask_ = capacity - 1;
+    for (size_t i = 0; i < capacity; ++i) {
+      slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    writer_ = std::thread([this]() { Run(); });
+  }
+
+  // Writes out whatever is still queued
+  ~AsyncLogSink() override {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_one();
+    writer_.join();
+  }
+
+  void log(const spdlog::details::log_msg& msg) override {
+    while (!TryPush(msg)) {
+      if (LogOverflowPolicy::kBlock != policy_) {
+        if (LogOverflowPolicy::kDropAndCount == policy_) {
+          dropped_.fetch_add(1, std::memory_order_relaxed);
+        }
+        return;
+      }
+      Wake();
+      std::this_thread::yield();
+    }
+    Wake();
+  }
+
+  // Asks the writer for a flush once the records queued so far are written
+  void flush() override {
+    flush_requested_.store(true, std::memory_order_relaxed);
+    Wake(true);
+  }
+
+  void set_pattern(const std::string& pattern) override {
+    for (auto& sink : sinks_) {
+      sink->set_pattern(pattern);
+    }
+  }
+
+  void set_formatter(std::unique_ptr<spdlog::formatter> formatter) override {
+    for (auto& sink : sinks_) {
+      sink->set_formatter(formatter->clone());
+    }
+  }
+
+  // Records discarded so far under kDropAndCount
+  uint64_t Dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+ private:
+  struct Slot {
+    std::atomic<size_t> sequence;
+    spdlog::details::log_msg_buffer msg;
+  };
+
+  // Bounded multi producer ring, every slot carries a sequence number that
+  // tells producers and the writer whose turn it is
+  bool TryPush(const spdlog::details::log_msg& msg) {
+    size_t pos = tail_.load(std::memory_order_relaxed);
+    Slot* slot;
+    for (;;) {
+      slot = &slots_[pos & mask_];
+      size_t sequence = slot->sequence.load(std::memory_order_acquire);
+      intptr_t diff =
+          static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+      if (0 == diff) {
+        if (tail_.compare_exchange_weak(pos, pos + 1,
+                                        std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = tail_.load(std::memory_order_relaxed);
+      }
+    }
+    slot->msg = spdlog::details::log_msg_buffer(msg);
+    slot->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Only the writer pops
+  bool TryPop(spdlog::details::log_msg_buffer* msg) {
+    Slot& slot = slots_[head_ & mask_];
+    if (slot.sequence.load(std::memory_order_acquire) != head_ + 1) {
+      return false;
+    }
+    *msg = std::move(slot.msg);
+    slot.sequence.store(head_ + mask_ + 1, std::memory_order_release);
+    ++head_;
+    return true;
+  }
+
+  // Producers only take the mutex when the writer went to sleep
+  void Wake(bool force = false) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (force || sleeping_.load(std::memory_order_relaxed)) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      cv_.notify_one();
+    }
+  }
+
+  void Write(const spdlog::details::log_msg& msg) {
+    for (auto& sink : sinks_) {
+      if (sink->should_log(msg.level)) {
+        sink->log(msg);
+      }
+    }
+  }
+
+  void Flush() {
+    for (auto& sink : sinks_) {
+      sink->flush();
+    }
+  }
+
+  void Run() {
+    auto last_flush = std::chrono::steady_clock::now();
+    bool unflushed = false;
+    spdlog::details::log_msg_buffer msg;
+    for (;;) {
+      bool stop;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop = stop_;
+      }
+
+      while (TryPop(&msg)) {
+        Write(msg);
+        unflushed = true;
+        if (spdlog::level::critical == msg.level) {
+          Flush();
+          unflushed = false;
+        }
+      }
+
+      // Checked on every wakeup, so drops are reported by the next flush
+      // tick even when nothing is logged after them. The report takes the
+      // logger name of the last record popped
+      uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+      if (dropped != reported_dropped_) {
+        std::string report =
+            "Log queue full, dropped [" +
+            std::to_string(dropped - reported_dropped_) + "] records";
+        reported_dropped_ = dropped;
+        Write(spdlog::details::log_msg(msg.logger_name, spdlog::level::warn,
+                                       report));
+        unflushed = true;
+      }
+
+      auto now = std::chrono::steady_clock::now();
+      if (flush_requested_.exchange(false, std::memory_order_relaxed) ||
+          (unflushed && now - last_flush >= flush_interval_) || stop) {
+        Flush();
+        unflushed = false;
+        last_flush = now;
+      }
+      if (stop) {
+        return;
+      }
+
+      // Sleep until a producer wakes us up or the next flush is due. The
+      // queue is checked again after announcing the sleep, so a record
+      // pushed in between is not left waiting
+      std::unique_lock<std::mutex> lock(mutex_);
+      sleeping_.store(true, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      cv_.wait_for(lock, flush_interval_, [this]() {
+        return stop_ || flush_requested_.load(std::memory_order_relaxed) ||
+               slots_[head_ & mask_].sequence.load(
+                   std::memory_order_acquire) == head_ + 1;
+      });
+      sleeping_.store(false, std::memory_order_relaxed);
+    }
+  }
+
+ private:
+  std::vector<spdlog::sink_ptr> sinks_;
+  const LogOverflowPolicy policy_;
+  const std::chrono::milliseconds flush_interval_;
+
+  std::unique_ptr<Slot[]> slots_;
+  size_t mask_ = 0;
+  std::atomic<size_t> tail_{0};
+  // Writer side, no other thread reads it
+  size_t head_ = 0;
+
+  std::atomic<uint64_t> dropped_{0};
+  uint64_t reported_dropped_ = 0;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::atomic<bool> sleeping_{false};
+  std::atomic<bool> flush_requested_{false};
+  bool stop_ = false;
+  std::thread writer_;
+};
+
+#endif
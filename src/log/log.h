@@ -1,12 +1,20 @@
 #ifndef _LOG_H_
 #define _LOG_H_
 
+// Statements below this level compile away, define it on the command line to
+// change the level. It has to come before any spdlog header
+#ifndef SPDLOG_ACTIVE_LEVEL
+#define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_INFO
+#endif
+
 #include <chrono>
 #include <iomanip>
 #include <iostream>
+#include <memory>
 #include <sstream>
 #include <string>
 
+#include "async_log_sink.h"
 #include "spdlog/common.h"
 #include "spdlog/logger.h"
 #include "spdlog/sinks/base_sink.h"
@@ -16,8 +24,6 @@
 
 using namespace std::chrono;
 
-#define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_INFO
-
 // SPDLOG_TRACE(...)
 // SPDLOG_DEBUG(...)
 // SPDLOG_INFO(...)
@@ -31,97 +37,69 @@ constexpr auto LOGGER_NAME = "siganl_server";
 constexpr auto LOGGER_NAME = "remote_desk";
 #endif
 
-#define LOG_INFO(...)                                                         \
-  if (nullptr == spdlog::get(LOGGER_NAME)) {                                  \
-    auto now = std::chrono::system_clock::now() + std::chrono::hours(8);      \
-    auto timet = std::chrono::system_clock::to_time_t(now);                   \
-    auto localTime = *std::gmtime(&timet);                                    \
-    std::stringstream ss;                                                     \
-    std::string filename;                                                     \
-    ss << LOGGER_NAME;                                                        \
-    ss << std::put_time(&localTime, "-%Y%m%d-%H%M%S.log");                    \
-    ss >> filename;                                                           \
-    std::string path = "logs/" + filename;                                    \
-    std::vector<spdlog::sink_ptr> sinks;                                      \
-    sinks.push_back(std::make_shared<spdlog::sinks::stdout_color_sink_mt>()); \
-    sinks.push_back(std::make_shared<spdlog::sinks::rotating_file_sink_mt>(   \
-        path, 1048576 * 5, 3));                                               \
-    auto combined_logger = std::make_shared<spdlog::logger>(                  \
-        LOGGER_NAME, begin(sinks), end(sinks));                               \
-    combined_logger->flush_on(spdlog::level::info);                           \
-    spdlog::register_logger(combined_logger);                                 \
-    SPDLOG_LOGGER_INFO(combined_logger, __VA_ARGS__);                         \
-  } else {                                                                    \
-    SPDLOG_LOGGER_INFO(spdlog::get(LOGGER_NAME), __VA_ARGS__);                \
-  }
+struct LogOptions {
+  // Records go through AsyncLogSink instead of being written by the thread
+  // that logs them
+  bool async = true;
+  size_t queue_size = 8192;
+  LogOverflowPolicy overflow_policy = LogOverflowPolicy::kBlock;
+  std::chrono::milliseconds flush_interval{1000};
+};
 
-#define LOG_WARN(...)                                                         \
-  if (nullptr == spdlog::get(LOGGER_NAME)) {                                  \
-    auto now = std::chrono::system_clock::now() + std::chrono::hours(8);      \
-    auto timet = std::chrono::system_clock::to_time_t(now);                   \
-    auto localTime = *std::gmtime(&timet);                                    \
-    std::stringstream ss;                                                     \
-    std::string filename;                                                     \
-    ss << LOGGER_NAME;                                                        \
-    ss << std::put_time(&localTime, "-%Y%m%d-%H%M%S.log");                    \
-    ss >> filename;                                                           \
-    std::string path = "logs/" + filename;                                    \
-    std::vector<spdlog::sink_ptr> sinks;                                      \
-    sinks.push_back(std::make_shared<spdlog::sinks::stdout_color_sink_mt>()); \
-    sinks.push_back(std::make_shared<spdlog::sinks::rotating_file_sink_mt>(   \
-        path, 1048576 * 5, 3));                                               \
-    auto combined_logger = std::make_shared<spdlog::logger>(                  \
-        LOGGER_NAME, begin(sinks), end(sinks));                               \
-    spdlog::register_logger(combined_logger);                                 \
-    SPDLOG_LOGGER_WARN(combined_logger, __VA_ARGS__);                         \
-  } else {                                                                    \
-    SPDLOG_LOGGER_WARN(spdlog::get(LOGGER_NAME), __VA_ARGS__);                \
-  }
+inline LogOptions& GetLogOptions() {
+  static LogOptions options;
+  return options;
+}
 
-#define LOG_ERROR(...)                                                        \
-  if (nullptr == spdlog::get(LOGGER_NAME)) {                                  \
-    auto now = std::chrono::system_clock::now() + std::chrono::hours(8);      \
-    auto timet = std::chrono::system_clock::to_time_t(now);                   \
-    auto localTime = *std::gmtime(&timet);                                    \
-    std::stringstream ss;                                                     \
-    std::string filename;                                                     \
-    ss << LOGGER_NAME;                                                        \
-    ss << std::put_time(&localTime, "-%Y%m%d-%H%M%S.log");                    \
-    ss >> filename;                                                           \
-    std::string path = "logs/" + filename;                                    \
-    std::vector<spdlog::sink_ptr> sinks;                                      \
-    sinks.push_back(std::make_shared<spdlog::sinks::stdout_color_sink_mt>()); \
-    sinks.push_back(std::make_shared<spdlog::sinks::rotating_file_sink_mt>(   \
-        path, 1048576 * 5, 3));                                               \
-    auto combined_logger = std::make_shared<spdlog::logger>(                  \
-        LOGGER_NAME, begin(sinks), end(sinks));                               \
-    spdlog::register_logger(combined_logger);                                 \
-    SPDLOG_LOGGER_ERROR(combined_logger, __VA_ARGS__);                        \
-  } else {                                                                    \
-    SPDLOG_LOGGER_ERROR(spdlog::get(LOGGER_NAME), __VA_ARGS__);               \
-  }
+// Takes effect when the logger is created, that is on the first record
+inline void SetLogOptions(const LogOptions& options) {
+  GetLogOptions() = options;
+}
+
+// Builds the stdout and rotating file logger and registers it, GetLogger
+// calls it once
+inline std::shared_ptr<spdlog::logger> CreateLogger() {
+  std::shared_ptr<spdlog::logger> logger;
+  auto now = std::chrono::system_clock::now() + std::chrono::hours(8);
+  auto timet = std::chrono::system_clock::to_time_t(now);
+  auto localTime = *std::gmtime(&timet);
+  std::stringstream ss;
+  std::string filename;
+  ss << LOGGER_NAME;
+  ss << std::put_time(&localTime, "-%Y%m%d-%H%M%S.log");
+  ss >> filename;
+  std::string path = "logs/" + filename;
+  std::vector<spdlog::sink_ptr> sinks;
+  sinks.push_back(std::make_shared<spdlog::sinks::stdout_color_sink_mt>());
+  sinks.push_back(std::make_shared<spdlog::sinks::rotating_file_sink_mt>(
+      path, 1048576 * 5, 3));
 
-#define LOG_FATAL(...)                                                        \
-  if (nullptr == spdlog::get(LOGGER_NAME)) {                                  \
-    auto now = std::chrono::system_clock::now() + std::chrono::hours(8);      \
-    auto timet = std::chrono::system_clock::to_time_t(now);                   \
-    auto localTime = *std::gmtime(&timet);                                    \
-    std::stringstream ss;                                                     \
-    std::string filename;                                                     \
-    ss << LOGGER_NAME;                                                        \
-    ss << std::put_time(&localTime, "-%Y%m%d-%H%M%S.log");                    \
-    ss >> filename;                                                           \
-    std::string path = "logs/" + filename;                                    \
-    std::vector<spdlog::sink_ptr> sinks;                                      \
-    sinks.push_back(std::make_shared<spdlog::sinks::stdout_color_sink_mt>()); \
-    sinks.push_back(std::make_shared<spdlog::sinks::rotating_file_sink_mt>(   \
-        path, 1048576 * 5, 3));                                               \
-    auto combined_logger = std::make_shared<spdlog::logger>(                  \
-        LOGGER_NAME, begin(sinks), end(sinks));                               \
-    spdlog::register_logger(combined_logger);                                 \
-    SPDLOG_LOGGER_CRITICAL(combined_logger, __VA_ARGS__);                     \
-  } else {                                                                    \
-    SPDLOG_LOGGER_CRITICAL(spdlog::get(LOGGER_NAME), __VA_ARGS__);            \
+  const LogOptions& options = GetLogOptions();
+  if (options.async) {
+    // The writer thread flushes on its own schedule
+    logger = std::make_shared<spdlog::logger>(
+        LOGGER_NAME, std::make_shared<AsyncLogSink>(
+                         std::move(sinks), options.queue_size,
+                         options.overflow_policy, options.flush_interval));
+  } else {
+    logger = std::make_shared<spdlog::logger>(LOGGER_NAME, begin(sinks),
+                                              end(sinks));
+    logger->flush_on(spdlog::level::info);
   }
+  spdlog::register_logger(logger);
+  return logger;
+}
+
+// The logger is created by the first call, from then on a call costs the
+// check of an initialized static, no registry lock or lookup
+inline spdlog::logger* GetLogger() {
+  static const std::shared_ptr<spdlog::logger> logger = CreateLogger();
+  return logger.get();
+}
+
+#define LOG_INFO(...) SPDLOG_LOGGER_INFO(GetLogger(), __VA_ARGS__)
+#define LOG_WARN(...) SPDLOG_LOGGER_WARN(GetLogger(), __VA_ARGS__)
+#define LOG_ERROR(...) SPDLOG_LOGGER_ERROR(GetLogger(), __VA_ARGS__)
+#define LOG_FATAL(...) SPDLOG_LOGGER_CRITICAL(GetLogger(), __VA_ARGS__)
 
 #endif
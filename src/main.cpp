@@ -1,10 +1,57 @@
 
 #include <iostream>
+#include <thread>
 
+#include "log.h"
 #include "signal_server.h"
 
+// Usage: signal_server [port] [thread_num] [shard_num] [journal_dir]
+//                      [trace_file] [log_overflow] [log_queue_size]
+//                      [log_flush_ms]
+// thread_num 0 means one thread per hardware core. With shard_num > 1 every
+// shard listens on the port with SO_REUSEPORT and runs thread_num threads,
+// each pinned to a core of its own when there are enough cores for all of
+// them, else left to the scheduler. With journal_dir every signaling event is
+// recorded to a binary journal there, "-" leaves it off. With trace_file
+// every connection and inbound frame is captured there for
+// tools/signal_replay, "-" leaves it off. log_overflow is what a full log
+// queue does to the thread that logs: block, drop, or count to drop and
+// report how many were dropped. log_queue_size records fit in the queue and
+// the log is flushed every log_flush_ms. "-" keeps the default of any of them
+constexpr size_t kJournalRecordsPerFile = 1 << 20;
+constexpr size_t kJournalMaxFiles = 8;
+constexpr std::chrono::seconds kLatencyLogInterval(60);
+
+// Whether argv[i] is given and not "-"
+static bool HasArg(int argc, char* argv[], int i) {
+  return argc > i && std::string("-") != argv[i];
+}
+
 int main(int argc, char* argv[]) {
-  SignalServer s;
+  LogOptions log_options;
+  if (HasArg(argc, argv, 6)) {
+    std::string overflow = argv[6];
+    if ("block" == overflow) {
+      log_options.overflow_policy = LogOverflowPolicy::kBlock;
+    } else if ("drop" == overflow) {
+      log_options.overflow_policy = LogOverflowPolicy::kDrop;
+    } else if ("count" == overflow) {
+      log_options.overflow_policy = LogOverflowPolicy::kDropAndCount;
+    } else {
+      std::cerr << "Unknown log overflow policy " << overflow << std::endl;
+      return 1;
+    }
+  }
+  if (HasArg(argc, argv, 7)) {
+    log_options.queue_size = std::stoul(argv[7]);
+  }
+  if (HasArg(argc, argv, 8)) {
+    log_options.flush_interval = std::chrono::milliseconds(std::stoi(argv[8]));
+  }
+  SetLogOptions(log_options);
+  // Create the logger before the event loop threads start logging
+  GetLogger();
+
   std::string port = "";
   if (argc > 1) {
     port = argv[1];
@@ -12,6 +59,72 @@ int main(int argc, char* argv[]) {
     port = "9090";
   }
 
-  s.run(std::stoi(port));
+  unsigned int thread_num = 1;
+  if (argc > 2) {
+    thread_num = std::stoi(argv[2]);
+    if (0 == thread_num) {
+      thread_num = std::thread::hardware_concurrency();
+    }
+  }
+
+  unsigned int shard_num = 1;
+  if (argc > 3) {
+    shard_num = std::stoi(argv[3]);
+  }
+
+  std::shared_ptr<EventJournal> journal;
+  if (HasArg(argc, argv, 4)) {
+    journal =
+        EventJournal::Open(argv[4], kJournalRecordsPerFile, kJournalMaxFiles);
+  }
+
+  std::shared_ptr<TraceWriter> trace;
+  if (HasArg(argc, argv, 5)) {
+    trace = TraceWriter::Open(argv[5]);
+  }
+
+  if (shard_num <= 1) {
+    SignalServer s;
+    s.set_event_journal(journal);
+    s.set_trace_writer(trace);
+    s.set_latency_log_interval(kLatencyLogInterval);
+    s.run(std::stoi(port), thread_num);
+    return 0;
+  }
+
+  LOG_INFO("Start [{}] signal server shards", shard_num);
+  auto transmission_manager = std::make_shared<TransmissionManager>();
+  auto client_id_generator = std::make_shared<ClientIdGenerator>();
+  // Pinning two loops to one core would make them take turns, leave them
+  // unpinned then
+  unsigned int core_num = std::thread::hardware_concurrency();
+  bool pin = shard_num * thread_num <= core_num;
+  if (!pin) {
+    LOG_INFO("[{}] event loop threads on [{}] cores, leave them unpinned",
+             shard_num * thread_num, core_num);
+  }
+
+  std::vector<std::unique_ptr<SignalServer>> shards;
+  for (unsigned int i = 0; i < shard_num; ++i) {
+    shards.emplace_back(
+        new SignalServer(transmission_manager, client_id_generator));
+    shards.back()->set_reuse_port(true);
+    shards.back()->set_cpu_affinity(pin ? i * thread_num : -1);
+    shards.back()->set_event_journal(journal);
+    shards.back()->set_trace_writer(trace);
+  }
+  // The latency histograms are process wide, one shard logs them
+  shards.front()->set_latency_log_interval(kLatencyLogInterval);
+
+  std::vector<std::thread> shard_threads;
+  for (auto& shard : shards) {
+    SignalServer* s = shard.get();
+    shard_threads.emplace_back(
+        [s, &port, thread_num]() { s->run(std::stoi(port), thread_num); });
+  }
+
+  for (auto& t : shard_threads) {
+    t.join();
+  }
   return 0;
-}
\ No newline at end of file
+}
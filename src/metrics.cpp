@@ -0,0 +1,260 @@
+#include "metrics.h"
+
+#include <cmath>
+#include <cstdio>
+
+namespace {
+
+struct CounterInfo {
+  Counter counter;
+  const char* name;
+  const char* labels;
+};
+
+// Counters sharing a name are one family, they have to be adjacent
+constexpr CounterInfo kCounterInfos[] = {
+    {Counter::kMessageLogin, "signal_messages_total", "type=\"login\""},
+    {Counter::kMessageCreateTransmission, "signal_messages_total",
+     "type=\"create_transmission\""},
+    {Counter::kMessageLeaveTransmission, "signal_messages_total",
+     "type=\"leave_transmission\""},
+    {Counter::kMessageQueryUserIdList, "signal_messages_total",
+     "type=\"query_user_id_list\""},
+    {Counter::kMessageOffer, "signal_messages_total", "type=\"offer\""},
+    {Counter::kMessageAnswer, "signal_messages_total", "type=\"answer\""},
+    {Counter::kMessageNewCandidate, "signal_messages_total",
+     "type=\"new_candidate\""},
+    {Counter::kMessageUnknown, "signal_messages_total", "type=\"unknown\""},
+    {Counter::kBytesIn, "signal_received_bytes_total", ""},
+    {Counter::kBytesOut, "signal_sent_bytes_total", ""},
+    {Counter::kFramesOut, "signal_sent_frames_total", ""},
+    {Counter::kParseFailures, "signal_parse_failures_total", ""},
+    {Counter::kConnectionsOpened, "signal_connections_opened_total", ""},
+    {Counter::kConnectionsClosed, "signal_connections_closed_total", ""},
+    {Counter::kLivenessExpiries, "signal_liveness_expiries_total", ""},
+    {Counter::kSendQueueDrops, "signal_send_queue_drops_total", ""},
+    {Counter::kSendQueueCloses, "signal_send_queue_closes_total", ""},
+};
+static_assert(sizeof(kCounterInfos) / sizeof(kCounterInfos[0]) ==
+                  static_cast<size_t>(Counter::kCounterNum),
+              "Every counter needs a name");
+
+const char* CounterHelp(std::string_view name) {
+  if ("signal_messages_total" == name) {
+    return "Signaling messages received, by type";
+  } else if ("signal_received_bytes_total" == name) {
+    return "Payload bytes received";
+  } else if ("signal_sent_bytes_total" == name) {
+    return "Payload bytes sent";
+  } else if ("signal_sent_frames_total" == name) {
+    return "Frames sent";
+  } else if ("signal_parse_failures_total" == name) {
+    return "Messages dropped because they could not be decoded";
+  } else if ("signal_connections_opened_total" == name) {
+    return "WebSocket connections opened";
+  } else if ("signal_connections_closed_total" == name) {
+    return "WebSocket connections closed";
+  } else if ("signal_liveness_expiries_total" == name) {
+    return "Connections closed by the idle timeout";
+  } else if ("signal_send_queue_drops_total" == name) {
+    return "Low priority frames dropped for a send queue over its limit";
+  } else if ("signal_send_queue_closes_total" == name) {
+    return "Connections closed for a send queue far over its limit";
+  }
+  return "";
+}
+
+// Quantiles of the latency summary, and their label values
+constexpr double kLatencyQuantiles[] = {0.5, 0.99, 0.999};
+constexpr const char* kLatencyQuantileLabels[] = {"0.5", "0.99", "0.999"};
+
+}  // namespace
+
+const char* LatencyTypeName(LatencyType type) {
+  switch (type) {
+    case LatencyType::kOffer:
+      return "offer";
+    case LatencyType::kAnswer:
+      return "answer";
+    case LatencyType::kNewCandidate:
+      return "new_candidate";
+    default:
+      return "unknown";
+  }
+}
+
+const char* LatencyStageName(LatencyStage stage) {
+  switch (stage) {
+    case LatencyStage::kParse:
+      return "parse";
+    case LatencyStage::kLookup:
+      return "lookup";
+    case LatencyStage::kSerialize:
+      return "serialize";
+    case LatencyStage::kEnqueue:
+      return "enqueue";
+    case LatencyStage::kTotal:
+      return "total";
+    default:
+      return "unknown";
+  }
+}
+
+uint64_t LatencyHistogram::BucketValue(size_t index) {
+  if (index < kSubBucketNum) {
+    return index;
+  }
+  size_t octave = (index - kSubBucketNum) / (kSubBucketNum / 2);
+  uint64_t sub_bucket = (index - kSubBucketNum) % (kSubBucketNum / 2) +
+                        kSubBucketNum / 2;
+  return ((sub_bucket + 1) << (octave + 1)) - 1;
+}
+
+uint64_t LatencySnapshot::Percentile(double q) const {
+  if (0 == count) {
+    return 0;
+  }
+  uint64_t rank = std::max<uint64_t>(
+      1, static_cast<uint64_t>(std::ceil(q * static_cast<double>(count))));
+  uint64_t seen = 0;
+  for (size_t i = 0; i < counts.size(); ++i) {
+    seen += counts[i];
+    if (seen >= rank) {
+      return LatencyHistogram::BucketValue(i);
+    }
+  }
+  return LatencyHistogram::BucketValue(counts.size() - 1);
+}
+
+LatencySnapshot LatencySnapshot::Since(const LatencySnapshot& earlier) const {
+  LatencySnapshot delta = *this;
+  if (earlier.counts.size() != counts.size()) {
+    return delta;
+  }
+  for (size_t i = 0; i < counts.size(); ++i) {
+    delta.counts[i] -= earlier.counts[i];
+  }
+  delta.count -= earlier.count;
+  delta.sum -= earlier.sum;
+  return delta;
+}
+
+Metrics::Shard* Metrics::RegisterThread() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  shards_.emplace_back(new Shard());
+  local_shard_ = shards_.back().get();
+  return local_shard_;
+}
+
+uint64_t Metrics::Sum(Counter counter) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  uint64_t sum = 0;
+  for (const auto& shard : shards_) {
+    sum += shard->values[static_cast<size_t>(counter)].load(
+        std::memory_order_relaxed);
+  }
+  return sum;
+}
+
+LatencySnapshot Metrics::SnapshotLatency(LatencyType type,
+                                         LatencyStage stage) {
+  LatencySnapshot snapshot;
+  snapshot.counts.resize(LatencyHistogram::kBucketNum);
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto& shard : shards_) {
+    const LatencyHistogram& histogram =
+        shard->latencies[static_cast<size_t>(type)]
+                        [static_cast<size_t>(stage)];
+    for (size_t i = 0; i < LatencyHistogram::kBucketNum; ++i) {
+      uint64_t count = histogram.Count(i);
+      snapshot.counts[i] += count;
+      snapshot.count += count;
+    }
+    snapshot.sum += histogram.Sum();
+  }
+  return snapshot;
+}
+
+void Metrics::WriteLatencies(std::string* out) {
+  static constexpr std::string_view kName = "signal_relay_latency_seconds";
+  PrometheusWriter writer(out);
+  writer.Family(kName, "summary",
+                "Time from a frame arriving to its relay being handed to the "
+                "socket, by message type and stage");
+  for (size_t type = 0;
+       type < static_cast<size_t>(LatencyType::kLatencyTypeNum); ++type) {
+    for (size_t stage = 0;
+         stage < static_cast<size_t>(LatencyStage::kLatencyStageNum);
+         ++stage) {
+      LatencySnapshot snapshot =
+          SnapshotLatency(static_cast<LatencyType>(type),
+                          static_cast<LatencyStage>(stage));
+      std::string labels = "type=\"";
+      labels += LatencyTypeName(static_cast<LatencyType>(type));
+      labels += "\",stage=\"";
+      labels += LatencyStageName(static_cast<LatencyStage>(stage));
+      labels += '"';
+      for (size_t i = 0; i < sizeof(kLatencyQuantiles) / sizeof(double); ++i) {
+        writer.Sample(kName,
+                      labels + ",quantile=\"" + kLatencyQuantileLabels[i] +
+                          '"',
+                      snapshot.Percentile(kLatencyQuantiles[i]) / 1e9);
+      }
+      writer.Sample(std::string(kName) + "_sum", labels, snapshot.sum / 1e9);
+      writer.Sample(std::string(kName) + "_count", labels, snapshot.count);
+    }
+  }
+}
+
+void Metrics::WriteCounters(std::string* out) {
+  PrometheusWriter writer(out);
+  std::string_view family;
+  for (const auto& info : kCounterInfos) {
+    if (family != info.name) {
+      family = info.name;
+      writer.Family(family, "counter", CounterHelp(family));
+    }
+    writer.Sample(info.name, info.labels, Sum(info.counter));
+  }
+}
+
+void PrometheusWriter::Family(std::string_view name, std::string_view type,
+                              std::string_view help) {
+  *out_ += "# HELP ";
+  *out_ += name;
+  *out_ += ' ';
+  *out_ += help;
+  *out_ += "\n# TYPE ";
+  *out_ += name;
+  *out_ += ' ';
+  *out_ += type;
+  *out_ += '\n';
+}
+
+void PrometheusWriter::Sample(std::string_view name, std::string_view labels,
+                              uint64_t value) {
+  *out_ += name;
+  if (!labels.empty()) {
+    *out_ += '{';
+    *out_ += labels;
+    *out_ += '}';
+  }
+  *out_ += ' ';
+  *out_ += std::to_string(value);
+  *out_ += '\n';
+}
+
+void PrometheusWriter::Sample(std::string_view name, std::string_view labels,
+                              double value) {
+  char buffer[32];
+  std::snprintf(buffer, sizeof(buffer), "%.9g", value);
+  *out_ += name;
+  if (!labels.empty()) {
+    *out_ += '{';
+    *out_ += labels;
+    *out_ += '}';
+  }
+  *out_ += ' ';
+  *out_ += buffer;
+  *out_ += '\n';
+}
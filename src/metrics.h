@@ -0,0 +1,208 @@
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+enum class Counter : uint32_t {
+  kMessageLogin = 0,
+  kMessageCreateTransmission,
+  kMessageLeaveTransmission,
+  kMessageQueryUserIdList,
+  kMessageOffer,
+  kMessageAnswer,
+  kMessageNewCandidate,
+  kMessageUnknown,
+  kBytesIn,
+  kBytesOut,
+  kFramesOut,
+  kParseFailures,
+  kConnectionsOpened,
+  kConnectionsClosed,
+  kLivenessExpiries,
+  kSendQueueDrops,
+  kSendQueueCloses,
+  kCounterNum,
+};
+
+// Relayed message types whose latency is measured
+enum class LatencyType : uint32_t {
+  kOffer = 0,
+  kAnswer,
+  kNewCandidate,
+  kLatencyTypeNum,
+};
+
+// Stages of relaying a message. Parse runs from the frame arriving to its
+// fields being scanned, lookup from there through the strand hop to the
+// destination connection being found, serialize until its frame is built and
+// enqueue until the frame is handed to the socket, another shard or a
+// candidate batch. Total spans all four
+enum class LatencyStage : uint32_t {
+  kParse = 0,
+  kLookup,
+  kSerialize,
+  kEnqueue,
+  kTotal,
+  kLatencyStageNum,
+};
+
+const char* LatencyTypeName(LatencyType type);
+const char* LatencyStageName(LatencyStage stage);
+
+// Nanosecond latencies counted in log linear buckets, laid out the way
+// HdrHistogram does: values below 64 have a bucket each, every power of two
+// above is split into 32 buckets, so a value is kept to within about 3
+// percent. Values from 2^36 ns, about 69 seconds, share the last bucket.
+// Recording is a relaxed load and store, only the owning thread writes.
+class LatencyHistogram {
+ public:
+  static constexpr int kSubBucketBits = 6;
+  static constexpr size_t kSubBucketNum = size_t{1} << kSubBucketBits;
+  static constexpr int kValueBits = 36;
+  static constexpr size_t kBucketNum =
+      kSubBucketNum + (kValueBits - kSubBucketBits) * kSubBucketNum / 2;
+
+  void Record(uint64_t value) {
+    Bump(&counts_[BucketIndex(value)], 1);
+    Bump(&sum_, value);
+  }
+
+  uint64_t Count(size_t index) const {
+    return counts_[index].load(std::memory_order_relaxed);
+  }
+  uint64_t Sum() const { return sum_.load(std::memory_order_relaxed); }
+
+  static size_t BucketIndex(uint64_t value) {
+    if (value < kSubBucketNum) {
+      return static_cast<size_t>(value);
+    }
+    value = std::min(value, (uint64_t{1} << kValueBits) - 1);
+    int bit = HighestBit(value);
+    int shift = bit - kSubBucketBits + 1;
+    return kSubBucketNum + (bit - kSubBucketBits) * kSubBucketNum / 2 +
+           static_cast<size_t>(value >> shift) - kSubBucketNum / 2;
+  }
+
+  // Highest value that falls into the bucket
+  static uint64_t BucketValue(size_t index);
+
+ private:
+  static void Bump(std::atomic<uint64_t>* slot, uint64_t value) {
+    slot->store(slot->load(std::memory_order_relaxed) + value,
+                std::memory_order_relaxed);
+  }
+
+  static int HighestBit(uint64_t value) {
+    int bit = 0;
+    for (int step = 32; step > 0; step >>= 1) {
+      if (value >> step) {
+        value >>= step;
+        bit += step;
+      }
+    }
+    return bit;
+  }
+
+  std::atomic<uint64_t> counts_[kBucketNum] = {};
+  std::atomic<uint64_t> sum_{0};
+};
+
+// A latency histogram summed over all threads
+struct LatencySnapshot {
+  std::vector<uint64_t> counts;
+  uint64_t count = 0;
+  uint64_t sum = 0;
+
+  // Upper end of the bucket holding quantile q, 0 when nothing was recorded
+  uint64_t Percentile(double q) const;
+
+  // What was recorded after earlier was taken
+  LatencySnapshot Since(const LatencySnapshot& earlier) const;
+};
+
+// Process wide counters and latency histograms. Every thread adds to its own
+// shard with plain relaxed loads and stores, a scrape sums what all threads
+// have counted, so counting costs no locked instruction and no contention.
+// Threads register on their first count and their counts outlive them.
+class Metrics {
+ public:
+  static void Add(Counter counter, uint64_t value = 1) {
+    std::atomic<uint64_t>& slot =
+        LocalShard()->values[static_cast<size_t>(counter)];
+    slot.store(slot.load(std::memory_order_relaxed) + value,
+               std::memory_order_relaxed);
+  }
+
+  static void RecordLatency(LatencyType type, LatencyStage stage,
+                            int64_t latency_ns) {
+    LocalShard()
+        ->latencies[static_cast<size_t>(type)][static_cast<size_t>(stage)]
+        .Record(latency_ns > 0 ? static_cast<uint64_t>(latency_ns) : 0);
+  }
+
+  // Steady clock nanoseconds, for measuring latencies. Not CoarseClock: a
+  // relay stage takes microseconds, well under its millisecond ticks, and
+  // rounding both ends to a tick would put nearly every sample in bucket 0
+  static int64_t NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  static uint64_t Sum(Counter counter);
+
+  static LatencySnapshot SnapshotLatency(LatencyType type, LatencyStage stage);
+
+  // Counters in the Prometheus text format, see PrometheusWriter for adding
+  // gauges after them
+  static void WriteCounters(std::string* out);
+
+  // Latencies as a Prometheus summary of p50, p99 and p999 since start
+  static void WriteLatencies(std::string* out);
+
+ private:
+  struct alignas(64) Shard {
+    std::atomic<uint64_t> values[static_cast<size_t>(Counter::kCounterNum)] =
+        {};
+    LatencyHistogram
+        latencies[static_cast<size_t>(LatencyType::kLatencyTypeNum)]
+                 [static_cast<size_t>(LatencyStage::kLatencyStageNum)];
+  };
+
+  static Shard* LocalShard() {
+    Shard* shard = local_shard_;
+    return shard ? shard : RegisterThread();
+  }
+
+  static Shard* RegisterThread();
+
+  inline static thread_local Shard* local_shard_ = nullptr;
+  inline static std::mutex mutex_;
+  inline static std::vector<std::unique_ptr<Shard>> shards_;
+};
+
+// Appends metric families in the Prometheus text exposition format
+class PrometheusWriter {
+ public:
+  explicit PrometheusWriter(std::string* out) : out_(out) {}
+
+  // type is "counter", "gauge" or "histogram"
+  void Family(std::string_view name, std::string_view type,
+              std::string_view help);
+  // labels is the inside of the braces, like type="offer", or empty
+  void Sample(std::string_view name, std::string_view labels, uint64_t value);
+  void Sample(std::string_view name, std::string_view labels, double value);
+
+ private:
+  std::string* out_;
+};
+
+#endif
@@ -0,0 +1,262 @@
+#include "sdp_dictionary.h"
+
+#include <zlib.h>
+
+#include <memory>
+
+namespace {
+
+// Lines of browser offers and answers, least common first since deflate
+// reaches the end of its window more cheaply. Every line ends in CRLF on the
+// wire, the dictionary builder takes care of that
+constexpr const char* kSdpLinesV1 = R"(a=rtpmap:35 AV1/90000
+a=rtpmap:36 rtx/90000
+a=fmtp:36 apt=35
+a=rtpmap:49 H265/90000
+a=fmtp:49 level-id=93;profile-id=1;tier-flag=0;tx-mode=SRST
+a=rtpmap:123 ulpfec/90000
+a=rtpmap:122 flexfec-03/90000
+a=fmtp:122 repair-window=10000000
+a=rtpmap:127 H264/90000
+a=fmtp:127 level-asymmetry-allowed=1;packetization-mode=0;profile-level-id=4d001f
+a=rtpmap:125 H264/90000
+a=fmtp:125 level-asymmetry-allowed=1;packetization-mode=1;profile-level-id=4d001f
+a=rtpmap:108 H264/90000
+a=fmtp:108 level-asymmetry-allowed=1;packetization-mode=0;profile-level-id=42e01f
+a=rtpmap:106 H264/90000
+a=fmtp:106 level-asymmetry-allowed=1;packetization-mode=1;profile-level-id=42e01f
+a=rtpmap:104 H264/90000
+a=fmtp:104 level-asymmetry-allowed=1;packetization-mode=0;profile-level-id=42001f
+a=rtpmap:102 H264/90000
+a=fmtp:102 level-asymmetry-allowed=1;packetization-mode=1;profile-level-id=42001f
+a=rtpmap:98 VP9/90000
+a=fmtp:98 profile-id=0
+a=rtpmap:100 VP9/90000
+a=fmtp:100 profile-id=2
+a=rtpmap:96 VP8/90000
+a=rtpmap:97 rtx/90000
+a=fmtp:97 apt=96
+a=rtpmap:110 telephone-event/48000
+a=rtpmap:126 telephone-event/8000
+a=rtpmap:13 CN/8000
+a=rtpmap:9 G722/8000
+a=rtpmap:0 PCMU/8000
+a=rtpmap:8 PCMA/8000
+a=rtpmap:63 red/48000/2
+a=fmtp:63 111/111
+a=rtpmap:111 opus/48000/2
+a=fmtp:111 minptime=10;useinbandfec=1
+a=extmap:14 urn:ietf:params:rtp-hdrext:toffset
+a=extmap:13 urn:3gpp:video-orientation
+a=extmap:12 http://www.webrtc.org/experiments/rtp-hdrext/playout-delay
+a=extmap:11 http://www.webrtc.org/experiments/rtp-hdrext/video-content-type
+a=extmap:7 http://www.webrtc.org/experiments/rtp-hdrext/video-timing
+a=extmap:8 http://www.webrtc.org/experiments/rtp-hdrext/color-space
+a=extmap:10 urn:ietf:params:rtp-hdrext:sdes:rtp-stream-id
+a=extmap:11 urn:ietf:params:rtp-hdrext:sdes:repaired-rtp-stream-id
+a=extmap:2 http://www.webrtc.org/experiments/rtp-hdrext/abs-send-time
+a=extmap:1 urn:ietf:params:rtp-hdrext:ssrc-audio-level
+a=extmap:3 http://www.ietf.org/id/draft-holmer-rmcat-transport-wide-cc-extensions-01
+a=extmap:4 urn:ietf:params:rtp-hdrext:sdes:mid
+m=video 9 UDP/TLS/RTP/SAVPF 96 97 98 99 100 101 35 36 37 38 102 103 104 105 106 107 108 109 127 125 39 40 45 46 112 113 116 117 118
+m=audio 9 UDP/TLS/RTP/SAVPF 111 63 9 0 8 13 110 126
+a=ssrc-group:FID
+a=ssrc: cname:
+a=ssrc: msid:
+a=msid-semantic: WMS
+a=group:BUNDLE 0 1
+a=extmap-allow-mixed
+a=setup:actpass
+a=setup:active
+a=ice-options:trickle
+a=fingerprint:sha-256
+a=sendrecv
+a=recvonly
+a=sendonly
+a=rtcp-mux
+a=rtcp-rsize
+a=rtcp:9 IN IP4 0.0.0.0
+c=IN IP4 0.0.0.0
+v=0
+o=- 2 IN IP4 127.0.0.1
+s=-
+t=0 0
+a=mid:0
+a=mid:1
+a=ice-ufrag:
+a=ice-pwd:
+a=msid:
+candidate: 1 udp 2122260223 typ srflx raddr rport generation 0 network-id 1 network-cost 10
+candidate: 1 tcp 1518280447 typ host tcptype passive generation 0 network-id 1
+a=candidate: 1 udp 2122260223 typ host generation 0 network-id 1
+)";
+
+// The rtcp-fb block every video codec repeats, most common of all
+constexpr const char* kRtcpFbV1 = R"( goog-remb
+a=rtcp-fb: transport-cc
+a=rtcp-fb: ccm fir
+a=rtcp-fb: nack
+a=rtcp-fb: nack pli
+a=rtcp-fb:
+)";
+
+// Message framing, sent with every message
+constexpr const char* kMessageV1 =
+    "{\"type\":\"new_candidate\",\"transmission_id\":\"\",\"user_id\":\"\","
+    "\"remote_user_id\":\"\",\"sdp\":\"\",\"sdpMid\":\"0\",\"sdpMLineIndex\":0}"
+    "{\"remote_user_id\":\"\",\"sdp\":\"v=0\\r\\no=- \",\"transmission_id\":"
+    "\"\",\"type\":\"answer\",\"user_id\":\"\"}"
+    "{\"type\":\"offer\",\"transmission_id\":\"\",\"user_id\":\"\","
+    "\"remote_user_id\":\"\",\"sdp\":\"v=0\\r\\no=- ";
+
+// Appends text with its line breaks escaped the way JSON carries an sdp
+void AppendEscapedLines(const char* text, std::string* out) {
+  for (const char* c = text; *c; ++c) {
+    if ('\n' == *c) {
+      *out += "\\r\\n";
+    } else {
+      *out += *c;
+    }
+  }
+}
+
+std::string BuildDictionaryV1() {
+  std::string dictionary;
+  AppendEscapedLines(kSdpLinesV1, &dictionary);
+  AppendEscapedLines(kRtcpFbV1, &dictionary);
+  dictionary += kMessageV1;
+  return dictionary;
+}
+
+struct DeflateStream {
+  z_stream stream = {};
+  bool initialized = false;
+
+  ~DeflateStream() {
+    if (initialized) {
+      deflateEnd(&stream);
+    }
+  }
+};
+
+struct InflateStream {
+  z_stream stream = {};
+  bool initialized = false;
+
+  ~InflateStream() {
+    if (initialized) {
+      inflateEnd(&stream);
+    }
+  }
+};
+
+}  // namespace
+
+std::string_view SdpDictionary(int version) {
+  static const std::string dictionary_v1 = BuildDictionaryV1();
+  if (1 == version) {
+    return dictionary_v1;
+  }
+  return std::string_view();
+}
+
+bool DeflateWithSdpDictionary(std::string_view in, int version,
+                              std::string* out) {
+  std::string_view dictionary = SdpDictionary(version);
+  if (dictionary.empty()) {
+    return false;
+  }
+
+  // One stream per thread, reset and primed again for every message
+  thread_local std::unique_ptr<DeflateStream> s;
+  if (!s) {
+    s.reset(new DeflateStream());
+    if (Z_OK != deflateInit2(&s->stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                             -15, 8, Z_DEFAULT_STRATEGY)) {
+      s.reset();
+      return false;
+    }
+    s->initialized = true;
+  } else if (Z_OK != deflateReset(&s->stream)) {
+    return false;
+  }
+  if (Z_OK != deflateSetDictionary(
+                  &s->stream,
+                  reinterpret_cast<const Bytef*>(dictionary.data()),
+                  static_cast<uInt>(dictionary.size()))) {
+    return false;
+  }
+
+  out->resize(deflateBound(&s->stream, in.size()) + 16);
+  s->stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+  s->stream.avail_in = static_cast<uInt>(in.size());
+  s->stream.next_out = reinterpret_cast<Bytef*>(&(*out)[0]);
+  s->stream.avail_out = static_cast<uInt>(out->size());
+
+  int ret = deflate(&s->stream, Z_SYNC_FLUSH);
+  if (Z_OK != ret || 0 != s->stream.avail_in) {
+    return false;
+  }
+  size_t size = out->size() - s->stream.avail_out;
+  if (size < 4) {
+    return false;
+  }
+  out->resize(size - 4);
+  return true;
+}
+
+bool InflateWithSdpDictionary(std::string_view in, int version,
+                              size_t max_size, std::string* out) {
+  std::string_view dictionary = SdpDictionary(version);
+  if (dictionary.empty()) {
+    return false;
+  }
+
+  thread_local std::unique_ptr<InflateStream> s;
+  if (!s) {
+    s.reset(new InflateStream());
+    if (Z_OK != inflateInit2(&s->stream, -15)) {
+      s.reset();
+      return false;
+    }
+    s->initialized = true;
+  } else if (Z_OK != inflateReset(&s->stream)) {
+    return false;
+  }
+  // A raw stream takes its dictionary up front
+  if (Z_OK != inflateSetDictionary(
+                  &s->stream,
+                  reinterpret_cast<const Bytef*>(dictionary.data()),
+                  static_cast<uInt>(dictionary.size()))) {
+    return false;
+  }
+
+  static const unsigned char kTail[] = {0x00, 0x00, 0xff, 0xff};
+  const std::string_view inputs[] = {
+      in, std::string_view(reinterpret_cast<const char*>(kTail), 4)};
+
+  out->clear();
+  char buffer[16384];
+  for (const auto& input : inputs) {
+    s->stream.next_in =
+        reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+    s->stream.avail_in = static_cast<uInt>(input.size());
+    do {
+      s->stream.next_out = reinterpret_cast<Bytef*>(buffer);
+      s->stream.avail_out = sizeof(buffer);
+      int ret = inflate(&s->stream, Z_SYNC_FLUSH);
+      if (Z_OK != ret && Z_STREAM_END != ret && Z_BUF_ERROR != ret) {
+        return false;
+      }
+      size_t size = sizeof(buffer) - s->stream.avail_out;
+      if (out->size() + size > max_size) {
+        return false;
+      }
+      out->append(buffer, size);
+      if (Z_STREAM_END == ret) {
+        return true;
+      }
+    } while (0 == s->stream.avail_out);
+  }
+  return true;
+}
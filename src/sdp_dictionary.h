@@ -0,0 +1,32 @@
+#ifndef _SDP_DICTIONARY_H_
+#define _SDP_DICTIONARY_H_
+
+#include <string>
+#include <string_view>
+
+// Preset deflate dictionary for signaling messages. Offers and answers repeat
+// the same codec lists, rtcp-fb and extmap lines, so priming the compressor
+// with them leaves little more than the ids, keys and candidates of a
+// message to encode. The dictionary holds JSON text, the sdp lines escaped as
+// they appear inside a message.
+//
+// A version is frozen once released, clients fetch it from the server at
+// kSdpDictionaryPath followed by the version and select it through the
+// subprotocol of the matching WireEncoding.
+constexpr int kSdpDictionaryVersion = 1;
+constexpr const char* kSdpDictionaryPath = "/sdp-dictionary/v";
+
+// Empty for unknown versions
+std::string_view SdpDictionary(int version);
+
+// Raw deflate of in primed with the dictionary, flushed and stripped of the
+// trailing 00 00 ff ff like a permessage-deflate message, every message
+// stands on its own
+bool DeflateWithSdpDictionary(std::string_view in, int version,
+                              std::string* out);
+
+// Fails on malformed input or when the output would exceed max_size
+bool InflateWithSdpDictionary(std::string_view in, int version,
+                              size_t max_size, std::string* out);
+
+#endif
@@ -0,0 +1,238 @@
+#include "signal_message.h"
+
+#include <cstdint>
+#include <cstring>
+#include <nlohmann/json.hpp>
+
+namespace {
+
+// Whether any of the 8 bytes at data is a quote, a backslash or a control
+// character, the bytes a string scan has to stop at
+bool HasSpecialByte(const unsigned char* data) {
+  constexpr uint64_t kOnes = 0x0101010101010101ULL;
+  constexpr uint64_t kHighs = 0x8080808080808080ULL;
+  uint64_t x;
+  std::memcpy(&x, data, sizeof(x));
+  uint64_t quote = x ^ (kOnes * '"');
+  uint64_t backslash = x ^ (kOnes * '\\');
+  uint64_t special = ((quote - kOnes) & ~quote) |
+                     ((backslash - kOnes) & ~backslash) |
+                     ((x - kOnes * 0x20) & ~x);
+  return 0 != (special & kHighs);
+}
+
+class Scanner {
+ public:
+  explicit Scanner(std::string_view input) : input_(input) {}
+
+  bool AtEnd() const { return pos_ >= input_.size(); }
+  size_t Pos() const { return pos_; }
+
+  void SkipSpace() {
+    while (!AtEnd() && (input_[pos_] == ' ' || input_[pos_] == '\t' ||
+                        input_[pos_] == '\n' || input_[pos_] == '\r')) {
+      ++pos_;
+    }
+  }
+
+  bool Consume(char c) {
+    if (AtEnd() || input_[pos_] != c) {
+      return false;
+    }
+    ++pos_;
+    return true;
+  }
+
+  char Peek() const { return AtEnd() ? '\0' : input_[pos_]; }
+
+  // Reads a string token, value excludes the quotes and is left escaped
+  bool String(std::string_view* value, bool* escaped) {
+    if (!Consume('"')) {
+      return false;
+    }
+    size_t begin = pos_;
+    *escaped = false;
+    const unsigned char* data =
+        reinterpret_cast<const unsigned char*>(input_.data());
+    size_t size = input_.size();
+    while (pos_ < size) {
+      // Plain characters are the bulk of an sdp, skip them 8 at a time
+      while (pos_ + 8 <= size && !HasSpecialByte(data + pos_)) {
+        pos_ += 8;
+      }
+      while (pos_ < size && data[pos_] >= 0x20 && data[pos_] != '"' &&
+             data[pos_] != '\\') {
+        ++pos_;
+      }
+      if (pos_ >= size) {
+        break;
+      }
+      unsigned char c = data[pos_];
+      if (c == '"') {
+        *value = input_.substr(begin, pos_ - begin);
+        ++pos_;
+        return true;
+      } else if (c == '\\') {
+        *escaped = true;
+        pos_ += 2;
+      } else {
+        return false;
+      }
+    }
+    return false;
+  }
+
+  // Skips an object or array, strings inside are skipped as a whole
+  bool Nested() {
+    int depth = 0;
+    while (!AtEnd()) {
+      char c = input_[pos_];
+      if (c == '"') {
+        std::string_view value;
+        bool escaped;
+        if (!String(&value, &escaped)) {
+          return false;
+        }
+        continue;
+      }
+      ++pos_;
+      if (c == '{' || c == '[') {
+        ++depth;
+      } else if (c == '}' || c == ']') {
+        if (--depth == 0) {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  // Skips a number, true, false or null
+  bool Literal() {
+    size_t begin = pos_;
+    while (!AtEnd()) {
+      char c = input_[pos_];
+      if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || c == '-' ||
+          c == '+' || c == '.' || c == 'E') {
+        ++pos_;
+      } else {
+        break;
+      }
+    }
+    return pos_ > begin;
+  }
+
+ private:
+  std::string_view input_;
+  size_t pos_ = 0;
+};
+
+// Stores a string field seen only once, ids must come without escapes
+bool SetField(std::string_view* field, std::string_view value, bool is_string,
+              bool escaped) {
+  if (!is_string || escaped || field->data() != nullptr) {
+    return false;
+  }
+  *field = value;
+  return true;
+}
+
+}  // namespace
+
+bool ScanSignalMessage(std::string_view payload, SignalFields* fields) {
+  *fields = SignalFields();
+
+  Scanner scanner(payload);
+  scanner.SkipSpace();
+  if (!scanner.Consume('{')) {
+    return false;
+  }
+  scanner.SkipSpace();
+
+  bool first = true;
+  while (!scanner.Consume('}')) {
+    if (!first && !scanner.Consume(',')) {
+      return false;
+    }
+    first = false;
+    scanner.SkipSpace();
+
+    std::string_view key;
+    bool key_escaped;
+    if (!scanner.String(&key, &key_escaped) || key_escaped) {
+      return false;
+    }
+    scanner.SkipSpace();
+    if (!scanner.Consume(':')) {
+      return false;
+    }
+    scanner.SkipSpace();
+
+    size_t value_pos = scanner.Pos();
+    std::string_view value;
+    bool is_string = false;
+    bool escaped = false;
+    if ('"' == scanner.Peek()) {
+      is_string = true;
+      if (!scanner.String(&value, &escaped)) {
+        return false;
+      }
+    } else if ('{' == scanner.Peek() || '[' == scanner.Peek()) {
+      if (!scanner.Nested()) {
+        return false;
+      }
+    } else if (!scanner.Literal()) {
+      return false;
+    }
+
+    bool ok = true;
+    if ("type" == key) {
+      ok = SetField(&fields->type, value, is_string, escaped);
+    } else if ("transmission_id" == key) {
+      ok = SetField(&fields->transmission_id, value, is_string, escaped);
+    } else if ("user_id" == key) {
+      ok = SetField(&fields->user_id, value, is_string, escaped);
+    } else if ("remote_user_id" == key) {
+      ok = SetField(&fields->remote_user_id, value, is_string, escaped);
+      fields->remote_user_id_pos = value_pos;
+      fields->remote_user_id_len = scanner.Pos() - value_pos;
+    } else if ("sdp" == key) {
+      // The sdp is relayed as it is, escapes included
+      ok = is_string && !fields->has_sdp;
+      fields->sdp = value;
+      fields->has_sdp = true;
+    } else if ("password" == key) {
+      ok = SetField(&fields->password, value, is_string, false);
+      fields->password_escaped = escaped;
+    } else if ("features" == key) {
+      ok = SetField(&fields->features, value, is_string, escaped);
+    }
+    if (!ok) {
+      return false;
+    }
+    scanner.SkipSpace();
+  }
+
+  scanner.SkipSpace();
+  return scanner.AtEnd();
+}
+
+std::string UnescapeJsonString(std::string_view raw) {
+  std::string quoted;
+  quoted.reserve(raw.size() + 2);
+  quoted += '"';
+  quoted += raw;
+  quoted += '"';
+  return nlohmann::json::parse(quoted).get<std::string>();
+}
+
+void RewriteRemoteUserId(std::string* payload, const SignalFields& fields,
+                         std::string_view remote_user_id) {
+  // Ids are short, the copy keeps remote_user_id valid while payload moves
+  std::string value;
+  value.reserve(remote_user_id.size() + 2);
+  value += '"';
+  value += remote_user_id;
+  value += '"';
+  payload->replace(fields.remote_user_id_pos, fields.remote_user_id_len, value);
+}
@@ -0,0 +1,44 @@
+#ifndef _SIGNAL_MESSAGE_H_
+#define _SIGNAL_MESSAGE_H_
+
+#include <string>
+#include <string_view>
+
+// Fields of a signaling message the server acts on. The views point into the
+// scanned payload and are only valid while it is alive and unchanged. Fields
+// missing from the message are empty
+struct SignalFields {
+  std::string_view type;
+  std::string_view transmission_id;
+  std::string_view user_id;
+  std::string_view remote_user_id;
+  // Offset and length of the remote_user_id value, quotes included
+  size_t remote_user_id_pos = 0;
+  size_t remote_user_id_len = 0;
+  // Raw sdp string, still escaped as on the wire
+  std::string_view sdp;
+  bool has_sdp = false;
+  // Raw password, see UnescapeJsonString when password_escaped is set
+  std::string_view password;
+  bool password_escaped = false;
+  // Comma separated optional features a client takes, sent with login
+  std::string_view features;
+};
+
+// Scans a top level JSON object for the fields above in one pass, without
+// building a DOM or allocating, every other value is skipped over. Returns
+// false when the payload cannot be handled that way: fields that are not
+// strings, ids that carry escapes, escaped or duplicated keys, or malformed
+// input. Callers fall back to a full parse in that case.
+bool ScanSignalMessage(std::string_view payload, SignalFields* fields);
+
+// Decodes the escapes of a raw JSON string value
+std::string UnescapeJsonString(std::string_view raw);
+
+// Replaces the remote_user_id value found by ScanSignalMessage with
+// remote_user_id, in place. The rest of the payload, sdp included, is left
+// where it is. remote_user_id may point into payload itself
+void RewriteRemoteUserId(std::string* payload, const SignalFields& fields,
+                         std::string_view remote_user_id);
+
+#endif
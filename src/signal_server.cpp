@@ -1,376 +1,1464 @@
-#include "signal_server.h"
-
-#include "common.h"
-#include "log.h"
-
-const std::string GenerateTransmissionId() {
-  static const char alphanum[] = "0123456789";
-  std::string random_id;
-  random_id.reserve(6);
-
-  for (int i = 0; i < 6; ++i) {
-    random_id += alphanum[rand() % (sizeof(alphanum) - 1)];
-  }
-
-  return "000000";
-}
-
-SignalServer::SignalServer() {
-  // Set logging settings
-  server_.set_error_channels(websocketpp::log::elevel::all);
-  server_.set_access_channels(websocketpp::log::alevel::none);
-
-  // Initialize Asio
-  server_.init_asio();
-
-  server_.set_open_handler(
-      std::bind(&SignalServer::on_open, this, std::placeholders::_1));
-
-  server_.set_close_handler(
-      std::bind(&SignalServer::on_close, this, std::placeholders::_1));
-
-  server_.set_fail_handler(
-      std::bind(&SignalServer::on_fail, this, std::placeholders::_1));
-
-  server_.set_message_handler(std::bind(&SignalServer::on_message, this,
-                                        std::placeholders::_1,
-                                        std::placeholders::_2));
-
-  server_.set_ping_handler(bind(&SignalServer::on_ping, this,
-                                std::placeholders::_1, std::placeholders::_2));
-
-  server_.set_pong_handler(bind(&SignalServer::on_pong, this,
-                                std::placeholders::_1, std::placeholders::_2));
-}
-
-SignalServer::~SignalServer() {}
-
-bool SignalServer::on_open(websocketpp::connection_hdl hdl) {
-  ws_connections_[hdl] = ws_connection_id_++;
-  return true;
-}
-
-bool SignalServer::on_close(websocketpp::connection_hdl hdl) {
-  std::string user_id = transmission_manager_.ReleaseUserFromeWsHandle(hdl);
-  if (!user_id.empty()) {
-    LOG_INFO("Websocket connection [{}|{}] closed", ws_connections_[hdl],
-             user_id);
-
-    // check user is host or not
-    std::string transmission_id_host = transmission_manager_.IsHost(user_id);
-    if (!transmission_id_host.empty()) {
-      transmission_manager_.ReleaseTransmission(transmission_id_host);
-      LOG_INFO("Release transmission [{}] due to host [{}] leaves",
-               transmission_id_host, user_id);
-
-      // notify all users in transmission
-      json message = {{"type", "user_leave_transmission"},
-                      {"transmission_id", transmission_id_host},
-                      {"user_id", user_id}};
-
-      std::vector<std::string> user_id_list =
-          transmission_manager_.GetAllUserIdOfTransmission(
-              transmission_id_host);
-
-      for (const auto& user_id : user_id_list) {
-        send_msg(transmission_manager_.GetWsHandle(user_id), message);
-      }
-    }
-
-    // check user is guest or not
-    std::string transmission_id_guest = transmission_manager_.IsGuest(user_id);
-    if (!transmission_id_guest.empty()) {
-      transmission_manager_.ReleaseGuestFromTransmission(user_id);
-      LOG_INFO("Release guest [{}] from transmission [{}]", user_id,
-               transmission_id_guest);
-
-      // notify all users in transmission
-      json message = {{"type", "user_leave_transmission"},
-                      {"transmission_id", transmission_id_guest},
-                      {"user_id", user_id}};
-
-      std::vector<std::string> user_id_list =
-          transmission_manager_.GetAllUserIdOfTransmission(
-              transmission_id_guest);
-
-      for (const auto& user_id : user_id_list) {
-        send_msg(transmission_manager_.GetWsHandle(user_id), message);
-      }
-    }
-  }
-
-  ws_connections_.erase(hdl);
-
-  return true;
-}
-
-bool SignalServer::on_fail(websocketpp::connection_hdl hdl) {
-  std::string user_id = transmission_manager_.GetUserId(hdl);
-  if (!user_id.empty()) {
-    LOG_INFO("Websocket connection [{}|{}] failed", ws_connections_[hdl],
-             user_id);
-  }
-  return true;
-}
-
-bool SignalServer::on_ping(websocketpp::connection_hdl hdl, std::string s) {
-  transmission_manager_.UpdateWsHandleLastActiveTime(hdl);
-  return true;
-}
-
-bool SignalServer::on_pong(websocketpp::connection_hdl hdl, std::string s) {
-  return true;
-}
-
-void SignalServer::run(uint16_t port) {
-  LOG_INFO("Signal server runs on port [{}]", port);
-
-  server_.set_reuse_addr(true);
-  server_.listen(port);
-
-  // Queues a connection accept operation
-  server_.start_accept();
-
-  // Start the Asio io_service run loop
-  server_.run();
-}
-
-void SignalServer::send_msg(websocketpp::connection_hdl hdl, json message) {
-  if (!hdl.expired()) {
-    server_.send(hdl, message.dump(), websocketpp::frame::opcode::text);
-  } else {
-    LOG_ERROR("Destination hdl invalid");
-  }
-}
-
-void SignalServer::on_message(websocketpp::connection_hdl hdl,
-                              server::message_ptr msg) {
-  transmission_manager_.UpdateWsHandleLastActiveTime(hdl);
-  std::string payload = msg->get_payload();
-
-  auto j = json::parse(payload);
-  std::string type = j["type"].get<std::string>();
-
-  switch (HASH_STRING_PIECE(type.c_str())) {
-    case "login"_H: {
-      std::string host_id = j["user_id"].get<std::string>();
-      if (host_id.empty()) {
-        host_id = client_id_generator_.GeneratorNewId();
-        LOG_INFO("New client, assign id [{}] to it", host_id);
-      }
-
-      LOG_INFO("Receive login request with id [{}]", host_id);
-      bool success = transmission_manager_.BindUserToWsHandle(host_id, hdl);
-      if (success) {
-        json message = {
-            {"type", "login"}, {"user_id", host_id}, {"status", "success"}};
-        send_msg(hdl, message);
-      } else {
-        json message = {
-            {"type", "login"}, {"user_id", host_id}, {"status", "fail"}};
-        send_msg(hdl, message);
-      }
-
-      break;
-    }
-    case "create_transmission"_H: {
-      std::string transmission_id = j["transmission_id"].get<std::string>();
-      std::string password = j["password"].get<std::string>();
-      std::string host_id = j["user_id"].get<std::string>();
-
-      LOG_INFO(
-          "Receive host id [{}] create transmission request with transmission "
-          "id [{}]",
-          host_id, transmission_id);
-      if (!transmission_manager_.IsTransmissionExist(transmission_id)) {
-        if (transmission_id.empty()) {
-          transmission_id = GenerateTransmissionId();
-          while (transmission_manager_.IsTransmissionExist(transmission_id)) {
-            transmission_id = GenerateTransmissionId();
-          }
-          LOG_INFO(
-              "Transmission id is empty, generate a new one for this request "
-              "[{}]",
-              transmission_id);
-        }
-
-        transmission_manager_.BindHostToTransmission(host_id, transmission_id);
-        transmission_manager_.BindPasswordToTransmission(password,
-                                                         transmission_id);
-
-        LOG_INFO("Create transmission id [{}]", transmission_id);
-        json message = {{"type", "transmission_id"},
-                        {"transmission_id", transmission_id},
-                        {"status", "success"}};
-        send_msg(hdl, message);
-      } else {
-        LOG_INFO("Transmission id [{}] already exist", transmission_id);
-        json message = {{"type", "transmission_id"},
-                        {"transmission_id", transmission_id},
-                        {"status", "fail"},
-                        {"reason", "Transmission id exist"}};
-        send_msg(hdl, message);
-      }
-
-      break;
-    }
-    case "leave_transmission"_H: {
-      std::string transmission_id = j["transmission_id"].get<std::string>();
-      std::string user_id = j["user_id"].get<std::string>();
-      LOG_INFO("[{}] leaves transmission [{}]", user_id.c_str(),
-               transmission_id.c_str());
-
-      json message = {{"type", "user_leave_transmission"},
-                      {"transmission_id", transmission_id},
-                      {"user_id", user_id}};
-
-      std::vector<std::string> user_id_list =
-          transmission_manager_.GetAllUserIdOfTransmission(transmission_id);
-
-      for (const auto& user : user_id_list) {
-        if (user == user_id) {
-          continue;
-        }
-        send_msg(transmission_manager_.GetWsHandle(user), message);
-      }
-
-      bool is_host =
-          transmission_manager_.IsHostOfTransmission(user_id, transmission_id);
-
-      if (is_host) {
-        transmission_manager_.ReleaseTransmission(transmission_id);
-        LOG_INFO("Release transmission [{}] due to host leaves",
-                 transmission_id);
-      } else {
-        transmission_manager_.ReleaseGuestFromTransmission(user_id);
-      }
-
-      break;
-    }
-    case "query_user_id_list"_H: {
-      std::string transmission_id = j["transmission_id"].get<std::string>();
-      std::string password = j["password"].get<std::string>();
-
-      int ret = transmission_manager_.CheckPassword(password, transmission_id);
-
-      if (0 == ret) {
-        std::vector<std::string> user_id_list =
-            transmission_manager_.GetAllUserIdOfTransmission(transmission_id);
-
-        json message = {{"type", "user_id_list"},
-                        {"transmission_id", transmission_id},
-                        {"user_id_list", user_id_list},
-                        {"status", "success"}};
-
-        send_msg(hdl, message);
-      } else if (-1 == ret) {
-        std::vector<std::string> user_id_list;
-        json message = {{"type", "user_id_list"},
-                        {"transmission_id", transmission_id},
-                        {"user_id_list", user_id_list},
-                        {"status", "failed"},
-                        {"reason", "Incorrect password"}};
-        // LOG_INFO(
-        //     "Incorrect password [{}] for transmission [{}] with password is "
-        //     "[{}]",
-        //     password, transmission_id,
-        //     transmission_manager_.GetPassword(transmission_id));
-
-        send_msg(hdl, message);
-      } else if (-2 == ret) {
-        std::vector<std::string> user_id_list;
-        json message = {{"type", "user_id_list"},
-                        {"transmission_id", transmission_id},
-                        {"user_id_list", user_id_list},
-                        {"status", "failed"},
-                        {"reason", "No such transmission id"}};
-        // LOG_INFO(
-        //     "Incorrect password [{}] for transmission [{}] with password is "
-        //     "[{}]",
-        //     password, transmission_id,
-        //     transmission_manager_.GetPassword(transmission_id));
-
-        send_msg(hdl, message);
-      }
-
-      // LOG_INFO("Send member_list: [{}]", message.dump());
-
-      break;
-    }
-    case "offer"_H: {
-      std::string transmission_id = j["transmission_id"].get<std::string>();
-      std::string remote_user_id = j["remote_user_id"].get<std::string>();
-      std::string user_id = j["user_id"].get<std::string>();
-
-      transmission_manager_.BindGuestToTransmission(user_id, transmission_id);
-
-      websocketpp::connection_hdl destination_hdl =
-          transmission_manager_.GetWsHandle(remote_user_id);
-
-      if (j.contains("sdp")) {
-        std::string sdp = j["sdp"].get<std::string>();
-        json message = {
-            {"type", "offer"},
-            {"transmission_id", transmission_id},
-            {"remote_user_id", user_id},
-            {"sdp", sdp},
-        };
-        LOG_INFO("[{}] send offer to [{}]", user_id, remote_user_id);
-        send_msg(destination_hdl, message);
-
-      } else {
-        LOG_ERROR("Invalid offer msg");
-      }
-
-      break;
-    }
-    case "answer"_H: {
-      std::string transmission_id = j["transmission_id"].get<std::string>();
-      std::string remote_user_id = j["remote_user_id"].get<std::string>();
-      std::string user_id = j["user_id"].get<std::string>();
-
-      websocketpp::connection_hdl destination_hdl =
-          transmission_manager_.GetWsHandle(remote_user_id);
-
-      if (j.contains("sdp")) {
-        std::string sdp = j["sdp"].get<std::string>();
-        json message = {{"type", "answer"},
-                        {"sdp", sdp},
-                        {"remote_user_id", user_id},
-                        {"transmission_id", transmission_id}};
-        LOG_INFO("[{}] send answer to [{}]", user_id, remote_user_id);
-        send_msg(destination_hdl, message);
-      } else {
-        LOG_ERROR("Invalid answer msg");
-      }
-
-      break;
-    }
-    case "new_candidate"_H: {
-      std::string transmission_id = j["transmission_id"].get<std::string>();
-      std::string candidate = j["sdp"].get<std::string>();
-      std::string user_id = j["user_id"].get<std::string>();
-      std::string remote_user_id = j["remote_user_id"].get<std::string>();
-
-      websocketpp::connection_hdl destination_hdl =
-          transmission_manager_.GetWsHandle(remote_user_id);
-
-      // LOG_INFO("send candidate [{}]", candidate.c_str());
-      json message = {{"type", "new_candidate"},
-                      {"sdp", candidate},
-                      {"remote_user_id", user_id},
-                      {"transmission_id", transmission_id}};
-      send_msg(destination_hdl, message);
-      break;
-    }
-    default:
-      break;
-  }
-
-  // std::string sdp = j["sdp"];
-
-  // LOG_INFO("Message type: {}", type);
-  // LOG_INFO("Message body: {}", sdp);
-
-  // server_.send(hdl, msg->get_payload(), msg->get_opcode());
-}
\ No newline at end of file
+#include "signal_server.h"
+
+#include <algorithm>
+#include <random>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#endif
+
+#include "coarse_clock.h"
+#include "common.h"
+#include "log.h"
+#include "sdp_dictionary.h"
+
+// Transmissions are hashed onto a fixed set of strands
+constexpr size_t kStrandNum = 256;
+
+// Idle connections are checked once per tick, a turn of the wheel is about a
+// minute. The default timeout keeps the threshold of the old alive checker
+constexpr std::chrono::milliseconds kAliveTick(1000);
+constexpr size_t kAliveSlotNum = 64;
+constexpr std::chrono::seconds kDefaultAliveTimeout(100000000);
+
+// A connection setup trickles 10 to 40 candidates within a few milliseconds
+constexpr std::chrono::milliseconds kDefaultCandidateWindow(3);
+constexpr size_t kDefaultCandidateBatchMax = 16;
+
+// Login feature of clients that take new_candidates batches
+constexpr std::string_view kBatchCandidatesFeature = "new_candidates";
+
+// A guest on a stalled link stops taking candidates after about a thousand
+// frames, or a megabyte, and is closed at twice that
+constexpr size_t kDefaultSendQueueMaxBytes = 1 << 20;
+constexpr size_t kDefaultSendQueueMaxFrames = 1024;
+
+// Travels through websocketpp's send queue in place of a prepared frame and
+// counts it in queued_frames and queued_bytes until websocketpp lets go of it
+// after the write. The queues are members of the connection class
+// websocketpp derives from connection_data, so they are gone before con is
+struct send_token {
+  send_token(server::message_ptr sent_frame, connection_data* owner_con)
+      : frame(std::move(sent_frame)), con(owner_con) {
+    con->queued_frames.fetch_add(1, std::memory_order_relaxed);
+    con->queued_bytes.fetch_add(frame->get_payload().size(),
+                                std::memory_order_relaxed);
+  }
+  ~send_token() {
+    con->queued_frames.fetch_sub(1, std::memory_order_relaxed);
+    con->queued_bytes.fetch_sub(frame->get_payload().size(),
+                                std::memory_order_relaxed);
+  }
+
+  server::message_ptr frame;
+  connection_data* con;
+};
+
+const std::string GenerateTransmissionId() {
+  static const char alphanum[] = "0123456789";
+  // Workers generate ids at the same time, each draws from its own engine
+  thread_local std::mt19937 engine(std::random_device{}());
+  std::uniform_int_distribution<size_t> digit(0, sizeof(alphanum) - 2);
+  std::string random_id;
+  random_id.reserve(6);
+
+  for (int i = 0; i < 6; ++i) {
+    random_id += alphanum[digit(engine)];
+  }
+
+  return random_id;
+}
+
+SignalServer::SignalServer()
+    : SignalServer(std::make_shared<TransmissionManager>(),
+                   std::make_shared<ClientIdGenerator>()) {}
+
+SignalServer::SignalServer(
+    std::shared_ptr<TransmissionManager> transmission_manager,
+    std::shared_ptr<ClientIdGenerator> client_id_generator)
+    : candidate_window_(kDefaultCandidateWindow),
+      candidate_batch_max_(kDefaultCandidateBatchMax),
+      send_queue_max_bytes_(kDefaultSendQueueMaxBytes),
+      send_queue_max_frames_(kDefaultSendQueueMaxFrames),
+      transmission_manager_(transmission_manager),
+      client_id_generator_(client_id_generator) {
+  // Set logging settings
+  server_.set_error_channels(websocketpp::log::elevel::all);
+  server_.set_access_channels(websocketpp::log::alevel::none);
+
+#ifdef SIGNAL_SERVER_IOSTREAM
+  // Every replayed connection ends in an eof, which is not worth an error
+  server_.clear_error_channels(websocketpp::log::elevel::rerror);
+  // Replies go nowhere, the metrics count what would have been sent
+  server_.set_write_handler(
+      [](websocketpp::connection_hdl, char const*, size_t) {
+        return websocketpp::lib::error_code();
+      });
+#else
+  // Initialize Asio
+  server_.init_asio(&io_service_);
+#endif
+
+  for (size_t i = 0; i < kStrandNum; ++i) {
+    strands_.emplace_back(new strand(io_service_));
+  }
+
+  alive_wheel_.reset(
+      new TimingWheel(io_service_, kAliveTick, kAliveSlotNum));
+  alive_wheel_->SetTimeout(kDefaultAliveTimeout);
+  alive_wheel_->SetExpireHandler(
+      std::bind(&SignalServer::on_idle, this, std::placeholders::_1));
+  clock_timer_.reset(
+      new websocketpp::lib::asio::steady_timer(io_service_));
+  latency_timer_.reset(
+      new websocketpp::lib::asio::steady_timer(io_service_));
+
+#ifndef SIGNAL_SERVER_IOSTREAM
+  // Signaling messages are small and latency bound, Nagle would hold a reply
+  // back until the peer acks the previous one
+  server_.set_tcp_pre_init_handler([this](websocketpp::connection_hdl hdl) {
+    websocketpp::lib::error_code ec;
+    server::connection_ptr con = server_.get_con_from_hdl(hdl, ec);
+    if (con) {
+      websocketpp::lib::asio::error_code option_ec;
+      con->get_socket().set_option(
+          websocketpp::lib::asio::ip::tcp::no_delay(true), option_ec);
+    }
+  });
+#endif
+
+  server_.set_open_handler(
+      std::bind(&SignalServer::on_open, this, std::placeholders::_1));
+
+  server_.set_close_handler(
+      std::bind(&SignalServer::on_close, this, std::placeholders::_1));
+
+  server_.set_fail_handler(
+      std::bind(&SignalServer::on_fail, this, std::placeholders::_1));
+
+  server_.set_message_handler(std::bind(&SignalServer::on_message, this,
+                                        std::placeholders::_1,
+                                        std::placeholders::_2));
+
+  server_.set_validate_handler(
+      std::bind(&SignalServer::on_validate, this, std::placeholders::_1));
+
+  server_.set_http_handler(
+      std::bind(&SignalServer::on_http, this, std::placeholders::_1));
+
+  server_.set_ping_handler(bind(&SignalServer::on_ping, this,
+                                std::placeholders::_1, std::placeholders::_2));
+
+  server_.set_pong_handler(bind(&SignalServer::on_pong, this,
+                                std::placeholders::_1, std::placeholders::_2));
+
+  std::lock_guard<std::mutex> lock(instances_mutex_);
+  instances_.push_back(this);
+}
+
+SignalServer::~SignalServer() {
+  std::lock_guard<std::mutex> lock(instances_mutex_);
+  instances_.erase(std::remove(instances_.begin(), instances_.end(), this),
+                   instances_.end());
+}
+
+bool SignalServer::on_open(websocketpp::connection_hdl hdl) {
+  server::connection_ptr con = server_.get_con_from_hdl(hdl);
+  con->owner = this;
+  con->prepared_frames =
+      !con->get_request_header("Sec-WebSocket-Version").empty();
+
+  // The negotiated permessage-deflate parameters are in the response
+  const std::string& extensions =
+      con->get_response_header("Sec-WebSocket-Extensions");
+  if (std::string::npos != extensions.find("permessage-deflate")) {
+    if (std::string::npos !=
+        extensions.find("server_no_context_takeover")) {
+      size_t pos = extensions.find("server_max_window_bits=");
+      con->shared_deflate_bits =
+          std::string::npos != pos
+              ? atoi(extensions.c_str() + pos +
+                     strlen("server_max_window_bits="))
+              : 15;
+    } else {
+      con->own_deflate_context = true;
+    }
+  }
+  con->last_active.store(CoarseClock::Now(), std::memory_order_relaxed);
+  alive_wheel_->Add(hdl, &con->last_active);
+
+  {
+    std::lock_guard<std::mutex> lock(ws_connections_mutex_);
+    con->id = ws_connection_id_++;
+    ws_connections_[hdl] = con->id;
+  }
+  Metrics::Add(Counter::kConnectionsOpened);
+  journal_event(JournalEvent::kOpen, con);
+  if (trace_) {
+    con->trace_id = trace_->NextConnection();
+    trace_->Write(TraceKind::kOpen, con->trace_id, 0, con->get_subprotocol());
+  }
+  return true;
+}
+
+void SignalServer::journal_event(JournalEvent event,
+                                 const server::connection_ptr& con,
+                                 size_t size) {
+  if (!journal_) {
+    return;
+  }
+  JournalRecord record = {};
+  record.timestamp_us = EventJournal::NowUs();
+  record.event = event;
+  record.connection = con ? con->id : 0;
+  record.size = static_cast<uint32_t>(size);
+  journal_->Record(record);
+}
+
+connection_id SignalServer::get_connection_id(websocketpp::connection_hdl hdl) {
+  std::lock_guard<std::mutex> lock(ws_connections_mutex_);
+  auto it = ws_connections_.find(hdl);
+  return it != ws_connections_.end() ? it->second : 0;
+}
+
+void SignalServer::touch(websocketpp::connection_hdl hdl) {
+  websocketpp::lib::error_code ec;
+  server::connection_ptr con = server_.get_con_from_hdl(hdl, ec);
+  if (con) {
+    con->last_active.store(CoarseClock::Now(), std::memory_order_relaxed);
+  }
+}
+
+void SignalServer::tick_clock() {
+  int64_t now = CoarseClock::Update();
+  if (trace_) {
+    trace_->FlushIfDue(now);
+  }
+  clock_timer_->expires_after(CoarseClock::kResolution);
+  clock_timer_->async_wait(
+      [this](const websocketpp::lib::asio::error_code& ec) {
+        if (!ec) {
+          tick_clock();
+        }
+      });
+}
+
+void SignalServer::on_idle(websocketpp::connection_hdl hdl) {
+  LOG_INFO("Websocket connection [{}] is idle, close it",
+           get_connection_id(hdl));
+  Metrics::Add(Counter::kLivenessExpiries);
+  if (journal_) {
+    websocketpp::lib::error_code con_ec;
+    journal_event(JournalEvent::kIdleClose,
+                  server_.get_con_from_hdl(hdl, con_ec));
+  }
+
+  // on_close releases the user once the close handshake is done
+  websocketpp::lib::error_code ec;
+  server_.close(hdl, websocketpp::close::status::going_away, "Idle timeout",
+                ec);
+  if (ec) {
+    LOG_WARN("Close idle connection failed [{}]", ec.message());
+  }
+}
+
+bool SignalServer::on_close(websocketpp::connection_hdl hdl) {
+  Metrics::Add(Counter::kConnectionsClosed);
+  if (journal_) {
+    websocketpp::lib::error_code ec;
+    journal_event(JournalEvent::kClose, server_.get_con_from_hdl(hdl, ec));
+  }
+  if (trace_) {
+    websocketpp::lib::error_code ec;
+    server::connection_ptr con = server_.get_con_from_hdl(hdl, ec);
+    if (con) {
+      trace_->Write(TraceKind::kClose, con->trace_id, 0, std::string_view());
+    }
+  }
+
+  id_handle user_id = transmission_manager_->ReleaseUserFromeWsHandle(hdl);
+  if (kInvalidId != user_id) {
+    LOG_INFO("Websocket connection [{}|{}] closed", get_connection_id(hdl),
+             IdToString(user_id));
+
+    // The reference the connection binding held keeps user_id valid until
+    // the user has left every transmission
+    std::shared_ptr<void> reference(nullptr,
+                                    [user_id](void*) { ReleaseId(user_id); });
+    // leave each transmission in order with its pending messages
+    for (id_handle transmission_id :
+         transmission_manager_->GetTransmissionsOfUser(user_id)) {
+      get_strand(IdToString(transmission_id))
+          .dispatch([this, user_id, transmission_id, reference]() {
+            release_user(user_id, transmission_id);
+          });
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(ws_connections_mutex_);
+    ws_connections_.erase(hdl);
+  }
+
+  return true;
+}
+
+void SignalServer::release_user(id_handle user_id,
+                                id_handle transmission_id) {
+  // spelled before the release may drop the last reference to the id
+  std::string transmission = IdToString(transmission_id);
+  if (transmission_manager_->IsHostOfTransmission(user_id, transmission_id)) {
+    // collect the members before the transmission is gone
+    std::vector<TransmissionMember> member_list =
+        transmission_manager_->GetAllMemberOfTransmission(transmission_id);
+
+    transmission_manager_->ReleaseTransmission(transmission_id);
+    LOG_INFO("Release transmission [{}] due to host [{}] leaves", transmission,
+             IdToString(user_id));
+
+    // notify all users in transmission
+    json message = {{"type", "user_leave_transmission"},
+                    {"transmission_id", transmission},
+                    {"user_id", IdToString(user_id)}};
+
+    broadcast(member_list, message, user_id);
+  } else if (transmission_manager_->IsGuest(user_id) == transmission_id) {
+    transmission_manager_->ReleaseGuestFromTransmission(user_id);
+    LOG_INFO("Release guest [{}] from transmission [{}]", IdToString(user_id),
+             transmission);
+
+    // notify all users in transmission
+    json message = {{"type", "user_leave_transmission"},
+                    {"transmission_id", transmission},
+                    {"user_id", IdToString(user_id)}};
+
+    std::vector<TransmissionMember> member_list =
+        transmission_manager_->GetAllMemberOfTransmission(transmission_id);
+
+    broadcast(member_list, message);
+  }
+}
+
+bool SignalServer::on_fail(websocketpp::connection_hdl hdl) {
+  id_handle user_id = transmission_manager_->GetUserId(hdl);
+  if (kInvalidId != user_id) {
+    LOG_INFO("Websocket connection [{}|{}] failed", get_connection_id(hdl),
+             IdToString(user_id));
+  }
+  return true;
+}
+
+bool SignalServer::on_ping(websocketpp::connection_hdl hdl, std::string s) {
+  touch(hdl);
+  return true;
+}
+
+bool SignalServer::on_pong(websocketpp::connection_hdl hdl, std::string s) {
+  touch(hdl);
+  return true;
+}
+
+bool signal_request::get_header_as_plist(
+    std::string const& key, websocketpp::http::parameter_list& out) const {
+  bool error = request::get_header_as_plist(key, out);
+  if (error || "Sec-WebSocket-Extensions" != key) {
+    return error;
+  }
+
+  // The same pick as on_validate: the first subprotocol that parses
+  websocketpp::http::parameter_list subprotocols;
+  int dictionary_version = 0;
+  if (!request::get_header_as_plist("Sec-WebSocket-Protocol", subprotocols)) {
+    for (const auto& subprotocol : subprotocols) {
+      WireEncoding encoding;
+      if (ParseWireSubprotocol(subprotocol.first, &encoding)) {
+        dictionary_version = WireDictionaryVersion(encoding);
+        break;
+      }
+    }
+  }
+  if (0 != dictionary_version) {
+    out.erase(std::remove_if(out.begin(), out.end(),
+                             [](const auto& extension) {
+                               return "permessage-deflate" == extension.first;
+                             }),
+              out.end());
+  }
+  return false;
+}
+
+bool SignalServer::on_validate(websocketpp::connection_hdl hdl) {
+  server::connection_ptr con = server_.get_con_from_hdl(hdl);
+  for (const auto& subprotocol : con->get_requested_subprotocols()) {
+    WireEncoding encoding;
+    if (ParseWireSubprotocol(subprotocol, &encoding)) {
+      con->select_subprotocol(subprotocol);
+      con->encoding = encoding;
+      break;
+    }
+  }
+  return true;
+}
+
+void SignalServer::on_http(websocketpp::connection_hdl hdl) {
+  server::connection_ptr con = server_.get_con_from_hdl(hdl);
+  const std::string& resource = con->get_resource();
+  if ("/metrics" == resource) {
+    con->set_status(websocketpp::http::status_code::ok);
+    con->append_header("Content-Type", "text/plain; version=0.0.4");
+    con->set_body(render_metrics());
+    return;
+  }
+
+  std::string_view path(kSdpDictionaryPath);
+  std::string_view dictionary;
+  if (0 == resource.compare(0, path.size(), path)) {
+    dictionary = SdpDictionary(atoi(resource.c_str() + path.size()));
+  }
+
+  if (dictionary.empty()) {
+    con->set_status(websocketpp::http::status_code::not_found);
+    return;
+  }
+  con->set_status(websocketpp::http::status_code::ok);
+  con->append_header("Content-Type", "application/octet-stream");
+  // Released versions never change
+  con->append_header("Cache-Control", "public, max-age=31536000, immutable");
+  con->set_body(std::string(dictionary));
+}
+
+std::string SignalServer::render_metrics() {
+  std::string out;
+  Metrics::WriteCounters(&out);
+  Metrics::WriteLatencies(&out);
+  PrometheusWriter writer(&out);
+
+  uint64_t opened = Metrics::Sum(Counter::kConnectionsOpened);
+  uint64_t closed = Metrics::Sum(Counter::kConnectionsClosed);
+  writer.Family("signal_connections_active", "gauge",
+                "WebSocket connections open now");
+  writer.Sample("signal_connections_active", "",
+                opened > closed ? opened - closed : 0);
+
+  // Guests per transmission as a histogram, a label per transmission would
+  // grow without bound
+  static constexpr uint64_t kGuestBuckets[] = {0, 1, 2, 4, 8, 16, 32};
+  uint64_t bucket_counts[sizeof(kGuestBuckets) / sizeof(kGuestBuckets[0])] =
+      {};
+  std::vector<size_t> guest_nums =
+      transmission_manager_->GetGuestNumOfTransmissions();
+  uint64_t guest_sum = 0;
+  for (size_t guest_num : guest_nums) {
+    guest_sum += guest_num;
+    for (size_t i = 0; i < sizeof(kGuestBuckets) / sizeof(kGuestBuckets[0]);
+         ++i) {
+      if (guest_num <= kGuestBuckets[i]) {
+        ++bucket_counts[i];
+      }
+    }
+  }
+  writer.Family("signal_transmissions_active", "gauge",
+                "Transmissions open now");
+  writer.Sample("signal_transmissions_active", "",
+                static_cast<uint64_t>(guest_nums.size()));
+  writer.Family("signal_transmission_guests", "histogram",
+                "Guests per open transmission");
+  for (size_t i = 0; i < sizeof(kGuestBuckets) / sizeof(kGuestBuckets[0]);
+       ++i) {
+    writer.Sample("signal_transmission_guests_bucket",
+                  "le=\"" + std::to_string(kGuestBuckets[i]) + "\"",
+                  bucket_counts[i]);
+  }
+  writer.Sample("signal_transmission_guests_bucket", "le=\"+Inf\"",
+                static_cast<uint64_t>(guest_nums.size()));
+  writer.Sample("signal_transmission_guests_sum", "", guest_sum);
+  writer.Sample("signal_transmission_guests_count", "",
+                static_cast<uint64_t>(guest_nums.size()));
+
+  send_queue_stats send_queues;
+  {
+    std::lock_guard<std::mutex> lock(instances_mutex_);
+    for (SignalServer* instance : instances_) {
+      instance->collect_send_queues(&send_queues);
+    }
+  }
+  writer.Family("signal_send_queue_bytes", "gauge",
+                "Bytes waiting in the send buffers of all connections");
+  writer.Sample("signal_send_queue_bytes", "", send_queues.bytes);
+  writer.Family("signal_send_queue_max_bytes", "gauge",
+                "Bytes waiting in the fullest send buffer");
+  writer.Sample("signal_send_queue_max_bytes", "", send_queues.max_bytes);
+  writer.Family("signal_send_queue_frames", "gauge",
+                "Prepared frames queued on all connections and not written");
+  writer.Sample("signal_send_queue_frames", "", send_queues.frames);
+  writer.Family("signal_send_queue_max_frames", "gauge",
+                "Prepared frames queued on the fullest connection");
+  writer.Sample("signal_send_queue_max_frames", "", send_queues.max_frames);
+  writer.Family("signal_send_queue_over_limit", "gauge",
+                "Connections whose send queue is over its limit");
+  writer.Sample("signal_send_queue_over_limit", "", send_queues.over_limit);
+  writer.Family("signal_mailbox_frames", "gauge",
+                "Frames handed between shards and not yet sent");
+  writer.Sample("signal_mailbox_frames", "", send_queues.mailbox_frames);
+  return out;
+}
+
+void SignalServer::collect_send_queues(send_queue_stats* stats) {
+  std::vector<websocketpp::connection_hdl> hdls;
+  {
+    std::lock_guard<std::mutex> lock(ws_connections_mutex_);
+    hdls.reserve(ws_connections_.size());
+    for (const auto& connection : ws_connections_) {
+      hdls.push_back(connection.first);
+    }
+  }
+  for (const auto& hdl : hdls) {
+    websocketpp::lib::error_code ec;
+    server::connection_ptr con = server_.get_con_from_hdl(hdl, ec);
+    if (con) {
+      // websocketpp's own count belongs to the connection's shard
+      size_t bytes = con->queued_bytes.load(std::memory_order_relaxed);
+      size_t frames = con->queued_frames.load(std::memory_order_relaxed);
+      stats->bytes += bytes;
+      stats->max_bytes = std::max<uint64_t>(stats->max_bytes, bytes);
+      stats->frames += frames;
+      stats->max_frames = std::max<uint64_t>(stats->max_frames, frames);
+      if (over_send_queue_limit(bytes, frames)) {
+        ++stats->over_limit;
+      }
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(mailbox_mutex_);
+  stats->mailbox_frames += mailbox_.size();
+}
+
+void SignalServer::start_timers() {
+  tick_clock();
+  alive_wheel_->Start();
+  if (latency_log_interval_.count() > 0) {
+    log_latencies();
+  }
+}
+
+#ifdef SIGNAL_SERVER_IOSTREAM
+void SignalServer::start_streams() {
+  LOG_INFO("Signal server runs on the iostream transport");
+  start_timers();
+}
+
+server::connection_ptr SignalServer::create_stream_connection() {
+  server::connection_ptr con = server_.get_connection();
+  con->start();
+  return con;
+}
+
+size_t SignalServer::poll() {
+  size_t handler_num = io_service_.poll();
+  io_service_.restart();
+  return handler_num;
+}
+#else
+void SignalServer::run(uint16_t port, unsigned int thread_num) {
+  if (0 == thread_num) {
+    thread_num = 1;
+  }
+  LOG_INFO("Signal server runs on port [{}] with [{}] threads", port,
+           thread_num);
+
+  server_.set_reuse_addr(true);
+  if (reuse_port_) {
+    server_.set_tcp_pre_bind_handler(
+        [](server::acceptor_ptr acceptor) -> websocketpp::lib::error_code {
+#ifdef SO_REUSEPORT
+          int enable = 1;
+          if (0 != setsockopt(acceptor->native_handle(), SOL_SOCKET,
+                              SO_REUSEPORT, &enable, sizeof(enable))) {
+            LOG_ERROR("Set SO_REUSEPORT failed, errno [{}]", errno);
+          }
+#else
+          LOG_WARN("SO_REUSEPORT is not supported on this platform");
+#endif
+          return websocketpp::lib::error_code();
+        });
+  }
+  server_.listen(port);
+
+  // Queues a connection accept operation
+  server_.start_accept();
+
+  start_timers();
+
+  auto run_loop = [this](unsigned int index) {
+    if (cpu_affinity_ >= 0) {
+#ifdef __linux__
+      int cpu = cpu_affinity_ + static_cast<int>(index);
+      cpu_set_t cpu_set;
+      CPU_ZERO(&cpu_set);
+      CPU_SET(cpu, &cpu_set);
+      if (0 != pthread_setaffinity_np(pthread_self(), sizeof(cpu_set),
+                                      &cpu_set)) {
+        LOG_WARN("Pin event loop to cpu [{}] failed", cpu);
+      }
+#endif
+    }
+    server_.run();
+  };
+
+  // Start the Asio io_service run loop on the worker threads, the calling
+  // thread serves as the last worker
+  for (unsigned int i = 1; i < thread_num; ++i) {
+    workers_.emplace_back(run_loop, i);
+  }
+  run_loop(0);
+
+  for (auto& worker : workers_) {
+    if (worker.joinable()) {
+      worker.join();
+    }
+  }
+  workers_.clear();
+}
+
+void SignalServer::set_reuse_port(bool reuse_port) {
+  reuse_port_ = reuse_port;
+}
+
+void SignalServer::set_cpu_affinity(int first_cpu) {
+  cpu_affinity_ = first_cpu;
+}
+#endif
+
+void SignalServer::set_alive_timeout(std::chrono::seconds timeout) {
+  alive_wheel_->SetTimeout(timeout);
+}
+
+void SignalServer::set_event_journal(std::shared_ptr<EventJournal> journal) {
+  journal_ = journal;
+}
+
+void SignalServer::set_latency_log_interval(std::chrono::seconds interval) {
+  latency_log_interval_ = interval;
+}
+
+void SignalServer::set_trace_writer(std::shared_ptr<TraceWriter> trace) {
+  trace_ = trace;
+}
+
+void SignalServer::set_send_queue_limit(size_t max_bytes, size_t max_frames) {
+  send_queue_max_bytes_ = max_bytes;
+  send_queue_max_frames_ = max_frames;
+}
+
+void SignalServer::set_candidate_batching(std::chrono::milliseconds window,
+                                          size_t max_num) {
+  candidate_window_ = window;
+  candidate_batch_max_ = max_num;
+}
+
+void SignalServer::send_msg(websocketpp::connection_hdl hdl,
+                            const json& message) {
+  websocketpp::lib::error_code ec;
+  server::connection_ptr con;
+  if (!hdl.expired()) {
+    con = server_.get_con_from_hdl(hdl, ec);
+  }
+
+  if (!con) {
+    LOG_ERROR("Destination hdl invalid");
+    return;
+  }
+
+  frame_cache frames(message);
+  deliver(con, frames);
+}
+
+void SignalServer::broadcast(const std::vector<TransmissionMember>& members,
+                             const json& message, id_handle except_user_id) {
+  frame_cache frames(message);
+  for (const auto& member : members) {
+    if (member.user_id == except_user_id) {
+      continue;
+    }
+
+    websocketpp::lib::error_code ec;
+    server::connection_ptr con;
+    if (!member.hdl.expired()) {
+      con = server_.get_con_from_hdl(member.hdl, ec);
+    }
+    if (!con) {
+      LOG_ERROR("Destination hdl of [{}] invalid", IdToString(member.user_id));
+      continue;
+    }
+
+    deliver(con, frames);
+  }
+}
+
+frame_cache::frame_cache(const json& message) : message_(&message) {}
+
+frame_cache::frame_cache(server::message_ptr frame) {
+  frames_[static_cast<size_t>(WireEncoding::kJson)][0] = std::move(frame);
+}
+
+const server::message_ptr& frame_cache::get(WireEncoding encoding,
+                                            int deflate_bits) {
+  auto& frames = frames_[static_cast<size_t>(encoding)];
+  size_t index = deflate_bits >= 9 && deflate_bits <= 15 ? deflate_bits - 8 : 0;
+  server::message_ptr& frame = frames[index];
+  if (frame) {
+    return frame;
+  }
+
+  // Deflated with a dictionary straight from the JSON text, a message the
+  // dictionary cannot take goes out as a plain JSON text frame
+  int dictionary_version = WireDictionaryVersion(encoding);
+  if (0 != dictionary_version) {
+    const server::message_ptr& text = get(WireEncoding::kJson);
+    std::string payload;
+    if (!DeflateWithSdpDictionary(text->get_payload(), dictionary_version,
+                                  &payload)) {
+      return text;
+    }
+    frame = make_frame(std::move(payload), websocketpp::frame::opcode::binary);
+    return frame;
+  }
+
+  websocketpp::frame::opcode::value opcode =
+      WireEncoding::kJson == encoding ? websocketpp::frame::opcode::text
+                                      : websocketpp::frame::opcode::binary;
+  if (0 != index) {
+    const server::message_ptr& plain = get(encoding);
+    std::string payload;
+    if (!DeflateMessage(plain->get_payload(), deflate_bits, &payload)) {
+      return plain;
+    }
+    frame = make_frame(std::move(payload), opcode);
+    prepare_frame(frame, opcode, true);
+    return frame;
+  }
+
+  if (WireEncoding::kJson == encoding) {
+    frame = make_frame(message_->dump(), opcode);
+    return frame;
+  }
+
+  if (!message_) {
+    parsed_ = json::parse(
+        frames_[static_cast<size_t>(WireEncoding::kJson)][0]->get_payload());
+    message_ = &parsed_;
+  }
+  frame = make_frame(EncodeWire(*message_, encoding), opcode);
+  return frame;
+}
+
+server::message_ptr frame_cache::make_frame(
+    std::string payload, websocketpp::frame::opcode::value opcode) {
+  typedef signal_server_config::message_type message_type;
+  server::message_ptr frame = websocketpp::lib::make_shared<message_type>(
+      message_type::con_msg_man_ptr(), opcode);
+  frame->get_raw_payload() = std::move(payload);
+  prepare_frame(frame, opcode);
+  return frame;
+}
+
+void frame_cache::prepare_frame(const server::message_ptr& frame,
+                                websocketpp::frame::opcode::value opcode,
+                                bool compressed) {
+  size_t size = frame->get_payload().size();
+  websocketpp::frame::basic_header header(opcode, size, true, false,
+                                          compressed);
+  frame->set_opcode(opcode);
+  frame->set_header(websocketpp::frame::prepare_header(
+      header, websocketpp::frame::extended_header(size)));
+  frame->set_prepared(true);
+}
+
+void SignalServer::deliver(const server::connection_ptr& con,
+                           frame_cache& frames, SendPriority priority) {
+  deliver(con, frames.get(con->encoding, con->shared_deflate_bits),
+          priority);
+}
+
+void SignalServer::deliver(const server::connection_ptr& con,
+                           const server::message_ptr& frame,
+                           SendPriority priority) {
+  // The destination may live on another shard, hand the frame to its owner
+  if (con->owner && con->owner != this) {
+    con->owner->post_send(con, frame, priority);
+    return;
+  }
+  if (!admit_send(con, priority)) {
+    return;
+  }
+
+  Metrics::Add(Counter::kFramesOut);
+  Metrics::Add(Counter::kBytesOut, frame->get_payload().size());
+  if (con->prepared_frames && !con->own_deflate_context) {
+    // The token shares the frame and keeps count of it until written
+    con->send(server::message_ptr(
+        std::make_shared<send_token>(frame, con.get()), frame.get()));
+  } else {
+    // Let websocketpp frame it, compressing with the connection's context
+    con->send(frame->get_payload(), frame->get_opcode());
+  }
+}
+
+bool SignalServer::admit_send(const server::connection_ptr& con,
+                              SendPriority priority) {
+  size_t bytes = 0;
+  if (con->prepared_frames && !con->own_deflate_context) {
+    bytes = con->queued_bytes.load(std::memory_order_relaxed);
+  } else {
+    // No send_token counts these frames, publish what websocketpp holds
+    bytes = con->get_buffered_amount();
+    con->queued_bytes.store(bytes, std::memory_order_relaxed);
+  }
+  size_t frames = con->queued_frames.load(std::memory_order_relaxed);
+  if (!over_send_queue_limit(bytes, frames)) {
+    return true;
+  }
+
+  if (over_send_queue_limit(bytes, frames, 2)) {
+    // The close frame waits behind the queue, the close handshake timeout
+    // drops the connection if the peer never gets to it. Later frames find
+    // the connection closing
+    websocketpp::lib::error_code ec;
+    con->close(kCloseSendQueueFull, "Send queue full", ec);
+    if (!ec) {
+      LOG_WARN(
+          "Websocket connection [{}] is not reading, [{}] bytes in [{}] "
+          "frames queued, close it",
+          con->id, bytes, frames);
+      Metrics::Add(Counter::kSendQueueCloses);
+    }
+    return false;
+  }
+
+  if (SendPriority::kLow == priority) {
+    Metrics::Add(Counter::kSendQueueDrops);
+    return false;
+  }
+  return true;
+}
+
+bool SignalServer::over_send_queue_limit(size_t bytes, size_t frames,
+                                         size_t factor) const {
+  return (0 != send_queue_max_bytes_ &&
+          bytes > send_queue_max_bytes_ * factor) ||
+         (0 != send_queue_max_frames_ &&
+          frames > send_queue_max_frames_ * factor);
+}
+
+void SignalServer::post_send(server::connection_ptr con,
+                             server::message_ptr frame,
+                             SendPriority priority) {
+  bool idle = false;
+  {
+    std::lock_guard<std::mutex> lock(mailbox_mutex_);
+    idle = mailbox_.empty();
+    mailbox_.push_back({std::move(con), std::move(frame), priority});
+  }
+
+  // Only the first frame of a batch wakes the event loop up
+  if (idle) {
+    io_service_.post([this]() { drain_mailbox(); });
+  }
+}
+
+void SignalServer::drain_mailbox() {
+  std::vector<outbound_msg> batch;
+  {
+    std::lock_guard<std::mutex> lock(mailbox_mutex_);
+    batch.swap(mailbox_);
+  }
+
+  for (auto& msg : batch) {
+    deliver(msg.con, msg.frame, msg.priority);
+  }
+}
+
+strand& SignalServer::get_strand(std::string_view transmission_id) {
+  return *strands_[std::hash<std::string_view>()(transmission_id) %
+                   kStrandNum];
+}
+
+void SignalServer::on_message(websocketpp::connection_hdl hdl,
+                              server::message_ptr msg) {
+  websocketpp::lib::error_code ec;
+  server::connection_ptr con = server_.get_con_from_hdl(hdl, ec);
+  if (!con) {
+    return;
+  }
+  con->last_active.store(CoarseClock::Now(), std::memory_order_relaxed);
+  if (trace_) {
+    trace_->Write(TraceKind::kMessage, con->trace_id,
+                  static_cast<uint8_t>(msg->get_opcode()), msg->get_payload());
+  }
+  message_timing timing;
+  timing.received_ns = Metrics::NowNs();
+  Metrics::Add(Counter::kBytesIn, msg->get_payload().size());
+
+  // Binary frames of a connection that negotiated a binary encoding are
+  // decoded into JSON text once, everything past this point speaks JSON
+  int dictionary_version = WireDictionaryVersion(con->encoding);
+  if (websocketpp::frame::opcode::binary == msg->get_opcode() &&
+      0 != dictionary_version) {
+    std::string text;
+    if (!InflateWithSdpDictionary(msg->get_payload(), dictionary_version,
+                                  server_.get_max_message_size(), &text)) {
+      LOG_ERROR("Invalid {} message from [{}]",
+                WireEncodingSubprotocol(con->encoding),
+                get_connection_id(hdl));
+      Metrics::Add(Counter::kParseFailures);
+      journal_event(JournalEvent::kInvalid, con, msg->get_payload().size());
+      return;
+    }
+    msg->get_raw_payload().swap(text);
+  } else if (websocketpp::frame::opcode::binary == msg->get_opcode() &&
+             WireEncoding::kJson != con->encoding) {
+    try {
+      msg->get_raw_payload() =
+          DecodeWire(msg->get_payload(), con->encoding).dump();
+    } catch (const json::exception& e) {
+      LOG_ERROR("Invalid {} message from [{}]: {}",
+                WireEncodingSubprotocol(con->encoding),
+                get_connection_id(hdl), e.what());
+      Metrics::Add(Counter::kParseFailures);
+      journal_event(JournalEvent::kInvalid, con, msg->get_payload().size());
+      return;
+    }
+  }
+
+  // One pass over the payload picks out the fields the handlers need. The
+  // json DOM is only built for messages the scanner cannot take, to rewrite
+  // them into the plain form it can
+  SignalFields fields;
+  if (!ScanSignalMessage(msg->get_payload(), &fields)) {
+    try {
+      msg->get_raw_payload() = json::parse(msg->get_payload()).dump();
+    } catch (const json::exception& e) {
+      LOG_ERROR("Invalid message from [{}]: {}", get_connection_id(hdl),
+                e.what());
+      Metrics::Add(Counter::kParseFailures);
+      journal_event(JournalEvent::kInvalid, con, msg->get_payload().size());
+      return;
+    }
+    if (!ScanSignalMessage(msg->get_payload(), &fields)) {
+      LOG_ERROR("Invalid message from [{}]", get_connection_id(hdl));
+      Metrics::Add(Counter::kParseFailures);
+      journal_event(JournalEvent::kInvalid, con, msg->get_payload().size());
+      return;
+    }
+  }
+
+  timing.parsed_ns = Metrics::NowNs();
+
+  // Hand over to the strand of the transmission. Messages carrying no
+  // transmission id yet are keyed by user
+  get_strand(!fields.transmission_id.empty() ? fields.transmission_id
+                                             : fields.user_id)
+      .dispatch([this, hdl, msg, fields, timing]() {
+        handle_message(hdl, msg, fields, timing);
+      });
+}
+
+void SignalServer::relay_message(websocketpp::connection_hdl hdl,
+                                 server::message_ptr msg,
+                                 const SignalFields& fields,
+                                 const message_timing& timing) {
+  // Ids nobody bound are not interned from here, a relay cannot grow the id
+  // table
+  if ("offer" == fields.type) {
+    id_handle user = FindId(fields.user_id);
+    id_handle transmission = FindId(fields.transmission_id);
+    if (kInvalidId != user && kInvalidId != transmission) {
+      transmission_manager_->BindGuestToTransmission(user, transmission);
+    }
+  }
+
+  if (!fields.has_sdp || fields.remote_user_id.empty()) {
+    LOG_ERROR("Invalid {} msg", fields.type);
+    return;
+  }
+
+  websocketpp::connection_hdl destination_hdl =
+      transmission_manager_->GetWsHandle(FindId(fields.remote_user_id));
+
+  websocketpp::lib::error_code ec;
+  server::connection_ptr con;
+  if (!destination_hdl.expired()) {
+    con = server_.get_con_from_hdl(destination_hdl, ec);
+  }
+
+  if (!con) {
+    LOG_ERROR("Destination hdl invalid");
+    return;
+  }
+
+  if ("new_candidate" != fields.type) {
+    LOG_INFO("[{}] send {} to [{}]", fields.user_id, fields.type,
+             fields.remote_user_id);
+  }
+  int64_t looked_up_ns = Metrics::NowNs();
+
+  // The receiver sees the sender as its remote user, the views in fields are
+  // stale from here on
+  RewriteRemoteUserId(&msg->get_raw_payload(), fields, fields.user_id);
+  if ("new_candidate" == fields.type &&
+      con->batch_candidates.load(std::memory_order_relaxed)) {
+    SignalServer* owner = con->owner ? con->owner : this;
+    if (owner->candidate_window_.count() > 0) {
+      // The time the candidate then waits in its batch is by design and not
+      // counted
+      int64_t serialized_ns = Metrics::NowNs();
+      owner->batch_candidate(con, msg->get_payload());
+      record_relay_latency(timing, looked_up_ns, serialized_ns);
+      return;
+    }
+  }
+  frame_cache::prepare_frame(msg, websocketpp::frame::opcode::text);
+  frame_cache frames(std::move(msg));
+  const server::message_ptr& frame =
+      frames.get(con->encoding, con->shared_deflate_bits);
+  int64_t serialized_ns = Metrics::NowNs();
+  deliver(con, frame,
+          "new_candidate" == fields.type ? SendPriority::kLow
+                                         : SendPriority::kHigh);
+  record_relay_latency(timing, looked_up_ns, serialized_ns);
+}
+
+void SignalServer::record_relay_latency(const message_timing& timing,
+                                        int64_t looked_up_ns,
+                                        int64_t serialized_ns) {
+  if (LatencyType::kLatencyTypeNum == timing.latency_type) {
+    return;
+  }
+  int64_t sent_ns = Metrics::NowNs();
+  Metrics::RecordLatency(timing.latency_type, LatencyStage::kParse,
+                         timing.parsed_ns - timing.received_ns);
+  Metrics::RecordLatency(timing.latency_type, LatencyStage::kLookup,
+                         looked_up_ns - timing.parsed_ns);
+  Metrics::RecordLatency(timing.latency_type, LatencyStage::kSerialize,
+                         serialized_ns - looked_up_ns);
+  Metrics::RecordLatency(timing.latency_type, LatencyStage::kEnqueue,
+                         sent_ns - serialized_ns);
+  Metrics::RecordLatency(timing.latency_type, LatencyStage::kTotal,
+                         sent_ns - timing.received_ns);
+}
+
+void SignalServer::log_latencies() {
+  constexpr size_t kStageNum =
+      static_cast<size_t>(LatencyStage::kLatencyStageNum);
+  logged_latencies_.resize(
+      static_cast<size_t>(LatencyType::kLatencyTypeNum) * kStageNum);
+  for (size_t type = 0;
+       type < static_cast<size_t>(LatencyType::kLatencyTypeNum); ++type) {
+    LatencySnapshot deltas[kStageNum];
+    for (size_t stage = 0; stage < kStageNum; ++stage) {
+      LatencySnapshot snapshot =
+          Metrics::SnapshotLatency(static_cast<LatencyType>(type),
+                                   static_cast<LatencyStage>(stage));
+      LatencySnapshot& logged = logged_latencies_[type * kStageNum + stage];
+      deltas[stage] = snapshot.Since(logged);
+      logged = std::move(snapshot);
+    }
+
+    const LatencySnapshot& total =
+        deltas[static_cast<size_t>(LatencyStage::kTotal)];
+    if (0 == total.count) {
+      continue;
+    }
+    // Unused when LOG_INFO is compiled out
+    [[maybe_unused]] auto p99_us = [&deltas](LatencyStage stage) {
+      return deltas[static_cast<size_t>(stage)].Percentile(0.99) / 1e3;
+    };
+    LOG_INFO(
+        "[{}] relayed [{}] in the last [{}]s, p50 [{:.1f}]us p99 [{:.1f}]us "
+        "p999 [{:.1f}]us, p99 of parse [{:.1f}]us lookup [{:.1f}]us "
+        "serialize [{:.1f}]us enqueue [{:.1f}]us",
+        LatencyTypeName(static_cast<LatencyType>(type)), total.count,
+        latency_log_interval_.count(), total.Percentile(0.5) / 1e3,
+        total.Percentile(0.99) / 1e3, total.Percentile(0.999) / 1e3,
+        p99_us(LatencyStage::kParse), p99_us(LatencyStage::kLookup),
+        p99_us(LatencyStage::kSerialize), p99_us(LatencyStage::kEnqueue));
+  }
+
+  latency_timer_->expires_after(latency_log_interval_);
+  latency_timer_->async_wait(
+      [this](const websocketpp::lib::asio::error_code& ec) {
+        if (!ec) {
+          log_latencies();
+        }
+      });
+}
+
+void SignalServer::handle_message(websocketpp::connection_hdl hdl,
+                                  server::message_ptr msg,
+                                  const SignalFields& fields,
+                                  message_timing timing) {
+  struct message_route {
+    message_handler handler;
+    JournalEvent event;
+    Counter counter;
+    LatencyType latency_type;
+  };
+  // Adding a message type is one more entry here, lookups stay a single
+  // probe however many there are
+  static constexpr PerfectHashEntry<message_route> kRoutes[] = {
+      {"login",
+       {&SignalServer::handle_login, JournalEvent::kLogin,
+        Counter::kMessageLogin, LatencyType::kLatencyTypeNum}},
+      {"create_transmission",
+       {&SignalServer::handle_create_transmission,
+        JournalEvent::kCreateTransmission, Counter::kMessageCreateTransmission,
+        LatencyType::kLatencyTypeNum}},
+      {"leave_transmission",
+       {&SignalServer::handle_leave_transmission,
+        JournalEvent::kLeaveTransmission, Counter::kMessageLeaveTransmission,
+        LatencyType::kLatencyTypeNum}},
+      {"query_user_id_list",
+       {&SignalServer::handle_query_user_id_list,
+        JournalEvent::kQueryUserIdList, Counter::kMessageQueryUserIdList,
+        LatencyType::kLatencyTypeNum}},
+      {"offer",
+       {&SignalServer::relay_message, JournalEvent::kOffer,
+        Counter::kMessageOffer, LatencyType::kOffer}},
+      {"answer",
+       {&SignalServer::relay_message, JournalEvent::kAnswer,
+        Counter::kMessageAnswer, LatencyType::kAnswer}},
+      {"new_candidate",
+       {&SignalServer::relay_message, JournalEvent::kNewCandidate,
+        Counter::kMessageNewCandidate, LatencyType::kNewCandidate}},
+  };
+  static constexpr auto kRouteMap = MakePerfectHashMap(kRoutes);
+  static_assert(kRouteMap.Valid(),
+                "Message types must be unique and hash to distinct slots");
+
+  const message_route* route = kRouteMap.Find(fields.type);
+  if (!route) {
+    Metrics::Add(Counter::kMessageUnknown);
+    return;
+  }
+  Metrics::Add(route->counter);
+  timing.latency_type = route->latency_type;
+
+  if (!journal_) {
+    (this->*route->handler)(hdl, std::move(msg), fields, timing);
+    return;
+  }
+
+  // The ids are copied first, handlers may rewrite the payload under fields
+  JournalRecord record = {};
+  record.event = route->event;
+  record.size = static_cast<uint32_t>(msg->get_payload().size());
+  SetJournalId(record.transmission_id, fields.transmission_id);
+  SetJournalId(record.user_id, fields.user_id);
+  SetJournalId(record.remote_user_id, fields.remote_user_id);
+  websocketpp::lib::error_code ec;
+  server::connection_ptr con = server_.get_con_from_hdl(hdl, ec);
+  record.connection = con ? con->id : 0;
+
+  (this->*route->handler)(hdl, std::move(msg), fields, timing);
+
+  // The handler took well under a CoarseClock tick, so the latency needs the
+  // precise clock the relay stages are timed with
+  record.timestamp_us = EventJournal::NowUs();
+  record.latency_us = static_cast<uint32_t>(
+      std::max<int64_t>(0, Metrics::NowNs() - timing.received_ns) / 1000);
+  journal_->Record(record);
+}
+
+void SignalServer::handle_login(websocketpp::connection_hdl hdl,
+                                server::message_ptr msg,
+                                const SignalFields& fields,
+                                const message_timing& timing) {
+  std::string host_id(fields.user_id);
+  if (host_id.empty()) {
+    host_id = client_id_generator_->GeneratorNewId();
+    LOG_INFO("New client, assign id [{}] to it", host_id);
+  }
+
+  LOG_INFO("Receive login request with id [{}]", host_id);
+  for (std::string_view features = fields.features; !features.empty();) {
+    size_t end = features.find(',');
+    if (kBatchCandidatesFeature == features.substr(0, end)) {
+      websocketpp::lib::error_code ec;
+      server::connection_ptr con = server_.get_con_from_hdl(hdl, ec);
+      if (con) {
+        con->batch_candidates.store(true, std::memory_order_relaxed);
+      }
+    }
+    features = std::string_view::npos != end ? features.substr(end + 1)
+                                             : std::string_view();
+  }
+
+  ScopedId user(host_id);
+  bool success = transmission_manager_->BindUserToWsHandle(user.get(), hdl);
+  if (success) {
+    json message = {
+        {"type", "login"}, {"user_id", host_id}, {"status", "success"}};
+    send_msg(hdl, message);
+  } else {
+    json message = {
+        {"type", "login"}, {"user_id", host_id}, {"status", "fail"}};
+    send_msg(hdl, message);
+  }
+}
+
+void SignalServer::handle_create_transmission(websocketpp::connection_hdl hdl,
+                                              server::message_ptr msg,
+                                              const SignalFields& fields,
+                                              const message_timing& timing) {
+  std::string transmission_id(fields.transmission_id);
+  std::string password = fields.password_escaped
+                             ? UnescapeJsonString(fields.password)
+                             : std::string(fields.password);
+  std::string_view host_id = fields.user_id;
+
+  LOG_INFO(
+      "Receive host id [{}] create transmission request with transmission "
+      "id [{}]",
+      host_id, transmission_id);
+  if (transmission_id.empty()) {
+    // Dispatched on the strand of the user, the new id has a strand of its
+    // own
+    create_transmission_with_new_id(hdl, std::string(host_id), password,
+                                    kTransmissionIdAttempts);
+    return;
+  }
+
+  if (!create_transmission(hdl, transmission_id, std::string(host_id),
+                           password)) {
+    LOG_INFO("Transmission id [{}] already exist", transmission_id);
+    json message = {{"type", "transmission_id"},
+                    {"transmission_id", transmission_id},
+                    {"status", "fail"},
+                    {"reason", "Transmission id exist"}};
+    send_msg(hdl, message);
+  }
+}
+
+void SignalServer::create_transmission_with_new_id(
+    websocketpp::connection_hdl hdl, std::string host_id, std::string password,
+    int attempts) {
+  // Only a hint, the id may still be taken by the time its strand runs
+  std::string transmission_id;
+  bool found = false;
+  while (!found && attempts-- > 0) {
+    transmission_id = GenerateTransmissionId();
+    found = !transmission_manager_->IsTransmissionExist(
+        FindId(transmission_id));
+  }
+  if (!found) {
+    LOG_WARN("No free transmission id for host [{}] after [{}] attempts",
+             host_id, kTransmissionIdAttempts);
+    json message = {{"type", "transmission_id"},
+                    {"transmission_id", ""},
+                    {"status", "fail"},
+                    {"reason", "No free transmission id"}};
+    send_msg(hdl, message);
+    return;
+  }
+  LOG_INFO(
+      "Transmission id is empty, generate a new one for this request [{}]",
+      transmission_id);
+
+  get_strand(transmission_id)
+      .dispatch([this, hdl, transmission_id, host_id = std::move(host_id),
+                 password = std::move(password), attempts]() mutable {
+        if (!create_transmission(hdl, transmission_id, host_id, password)) {
+          // Taken meanwhile, the attempts left go on another id
+          create_transmission_with_new_id(hdl, std::move(host_id),
+                                          std::move(password), attempts);
+        }
+      });
+}
+
+bool SignalServer::create_transmission(websocketpp::connection_hdl hdl,
+                                       const std::string& transmission_id,
+                                       const std::string& host_id,
+                                       const std::string& password) {
+  if (transmission_manager_->IsTransmissionExist(FindId(transmission_id))) {
+    return false;
+  }
+
+  // Interned for the binds, which take their own references
+  ScopedId bound_transmission(transmission_id);
+  ScopedId host(host_id);
+  id_handle transmission = bound_transmission.get();
+  // Fails only when the transmission already has a host, handled as taken
+  if (!transmission_manager_->BindHostToTransmission(host.get(),
+                                                     transmission)) {
+    return false;
+  }
+  transmission_manager_->BindPasswordToTransmission(password, transmission);
+
+  LOG_INFO("Create transmission id [{}]", transmission_id);
+  json message = {{"type", "transmission_id"},
+                  {"transmission_id", transmission_id},
+                  {"status", "success"}};
+  send_msg(hdl, message);
+  return true;
+}
+
+void SignalServer::handle_leave_transmission(websocketpp::connection_hdl hdl,
+                                             server::message_ptr msg,
+                                             const SignalFields& fields,
+                                             const message_timing& timing) {
+  std::string_view transmission_id = fields.transmission_id;
+  std::string_view user_id = fields.user_id;
+  LOG_INFO("[{}] leaves transmission [{}]", user_id, transmission_id);
+
+  json message = {{"type", "user_leave_transmission"},
+                  {"transmission_id", transmission_id},
+                  {"user_id", user_id}};
+
+  id_handle transmission = FindId(transmission_id);
+  id_handle user = FindId(user_id);
+  std::vector<TransmissionMember> member_list =
+      transmission_manager_->GetAllMemberOfTransmission(transmission);
+
+  broadcast(member_list, message, user);
+
+  bool is_host =
+      transmission_manager_->IsHostOfTransmission(user, transmission);
+
+  if (is_host) {
+    transmission_manager_->ReleaseTransmission(transmission);
+    LOG_INFO("Release transmission [{}] due to host leaves",
+             transmission_id);
+  } else {
+    transmission_manager_->ReleaseGuestFromTransmission(user);
+  }
+}
+
+void SignalServer::handle_query_user_id_list(websocketpp::connection_hdl hdl,
+                                             server::message_ptr msg,
+                                             const SignalFields& fields,
+                                             const message_timing& timing) {
+  std::string_view transmission_id = fields.transmission_id;
+  std::string password = fields.password_escaped
+                             ? UnescapeJsonString(fields.password)
+                             : std::string(fields.password);
+
+  id_handle transmission = FindId(transmission_id);
+  int ret = transmission_manager_->CheckPassword(password, transmission);
+
+  if (0 == ret) {
+    std::vector<std::string> user_id_list;
+    for (id_handle user :
+         transmission_manager_->GetAllUserIdOfTransmission(transmission)) {
+      user_id_list.push_back(IdToString(user));
+    }
+
+    json message = {{"type", "user_id_list"},
+                    {"transmission_id", transmission_id},
+                    {"user_id_list", user_id_list},
+                    {"status", "success"}};
+
+    send_msg(hdl, message);
+  } else if (-1 == ret) {
+    std::vector<std::string> user_id_list;
+    json message = {{"type", "user_id_list"},
+                    {"transmission_id", transmission_id},
+                    {"user_id_list", user_id_list},
+                    {"status", "failed"},
+                    {"reason", "Incorrect password"}};
+    // LOG_INFO(
+    //     "Incorrect password [{}] for transmission [{}] with password is "
+    //     "[{}]",
+    //     password, transmission_id,
+    //     transmission_manager_->GetPassword(transmission));
+
+    send_msg(hdl, message);
+  } else if (-2 == ret) {
+    std::vector<std::string> user_id_list;
+    json message = {{"type", "user_id_list"},
+                    {"transmission_id", transmission_id},
+                    {"user_id_list", user_id_list},
+                    {"status", "failed"},
+                    {"reason", "No such transmission id"}};
+    // LOG_INFO(
+    //     "Incorrect password [{}] for transmission [{}] with password is "
+    //     "[{}]",
+    //     password, transmission_id,
+    //     transmission_manager_->GetPassword(transmission));
+
+    send_msg(hdl, message);
+  }
+
+  // LOG_INFO("Send member_list: [{}]", message.dump());
+}
+
+void SignalServer::batch_candidate(const server::connection_ptr& con,
+                                   const std::string& candidate) {
+  std::lock_guard<std::mutex> lock(con->candidate_mutex);
+  if (0 != con->candidate_num) {
+    con->candidate_batch += ',';
+  }
+  con->candidate_batch += candidate;
+  if (++con->candidate_num >= candidate_batch_max_) {
+    flush_candidates(con);
+    return;
+  }
+  if (1 != con->candidate_num) {
+    return;
+  }
+
+  // The first candidate opens the window, the timer is rearmed for every
+  // batch. A firing already queued when it is rearmed belongs to a batch
+  // sent since and is told apart by the generation
+  if (!con->candidate_timer) {
+    con->candidate_timer.reset(
+        new websocketpp::lib::asio::steady_timer(io_service_));
+  }
+  websocketpp::connection_hdl hdl = con->get_handle();
+  uint64_t generation = con->candidate_generation;
+  con->candidate_timer->expires_after(candidate_window_);
+  con->candidate_timer->async_wait(
+      [this, hdl, generation](const websocketpp::lib::asio::error_code& ec) {
+        if (ec) {
+          return;
+        }
+        websocketpp::lib::error_code con_ec;
+        server::connection_ptr con = server_.get_con_from_hdl(hdl, con_ec);
+        if (con) {
+          std::lock_guard<std::mutex> lock(con->candidate_mutex);
+          if (generation == con->candidate_generation) {
+            flush_candidates(con);
+          }
+        }
+      });
+}
+
+void SignalServer::flush_candidates(const server::connection_ptr& con) {
+  std::string batch;
+  size_t candidate_num = 0;
+  batch.swap(con->candidate_batch);
+  std::swap(candidate_num, con->candidate_num);
+  if (0 == candidate_num) {
+    return;
+  }
+  ++con->candidate_generation;
+
+  journal_event(JournalEvent::kCandidateBatch, con, batch.size());
+
+  // A lone candidate goes out as the message it came in
+  std::string payload;
+  if (1 == candidate_num) {
+    payload.swap(batch);
+  } else {
+    static constexpr std::string_view kPrefix =
+        "{\"type\":\"new_candidates\",\"candidates\":[";
+    payload.reserve(kPrefix.size() + batch.size() + 2);
+    payload += kPrefix;
+    payload += batch;
+    payload += "]}";
+  }
+  frame_cache frames(frame_cache::make_frame(std::move(payload),
+                                             websocketpp::frame::opcode::text));
+  deliver(con, frames, SendPriority::kLow);
+}
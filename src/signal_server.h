@@ -1,26 +1,175 @@
 #ifndef _SIGNAL_SERVER_H_
 #define _SIGNAL_SERVER_H_
 
+#include <atomic>
+#include <chrono>
 #include <functional>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <nlohmann/json.hpp>
 #include <set>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <websocketpp/common/asio.hpp>
+#ifdef SIGNAL_SERVER_IOSTREAM
+#include <websocketpp/config/core.hpp>
+#else
 #include <websocketpp/config/asio_no_tls.hpp>
+#endif
 #include <websocketpp/server.hpp>
 
 #include "client_id_generator.h"
+#include "deflate_extension.h"
+#include "event_journal.h"
+#include "id_interner.h"
+#include "metrics.h"
+#include "signal_message.h"
+#include "timing_wheel.h"
+#include "trace_file.h"
 #include "transmission_manager.h"
+#include "wire_encoding.h"
 
 using nlohmann::json;
 
-typedef websocketpp::server<websocketpp::config::asio> server;
+class SignalServer;
+
+// Per connection state, websocketpp derives every connection from it
+struct connection_data {
+  // Shard whose event loop owns the connection
+  SignalServer* owner = nullptr;
+  // Same as its connection_id, readable without the connection map lock
+  unsigned int id = 0;
+  // Id of the connection in the capture trace, unique across shards
+  uint32_t trace_id = 0;
+  // CoarseClock::Now() of the last frame received, read by the alive wheel
+  std::atomic<int64_t> last_active{0};
+  // Whether the peer speaks RFC 6455 framing and can take a prepared frame,
+  // the legacy hybi00 handshake does not
+  bool prepared_frames = false;
+  // Negotiated through the subprotocol when the connection is validated
+  WireEncoding encoding = WireEncoding::kJson;
+  // permessage-deflate without server context takeover, the connection takes
+  // shared frames compressed with this window. 0 when not negotiated so
+  int shared_deflate_bits = 0;
+  // permessage-deflate with context takeover, frames have to be compressed
+  // with the connection's own zlib context
+  bool own_deflate_context = false;
+
+  // Set at login by clients that take new_candidates batches
+  std::atomic<bool> batch_candidates{false};
+  // Candidates relayed to the connection while the coalescing window is
+  // open, joined by commas. Guarded by candidate_mutex
+  std::mutex candidate_mutex;
+  std::string candidate_batch;
+  size_t candidate_num = 0;
+  // Counts the batches sent, a window timer only flushes the batch it was
+  // armed for
+  uint64_t candidate_generation = 0;
+  std::unique_ptr<websocketpp::lib::asio::steady_timer> candidate_timer;
+
+  // Frames handed to websocketpp and not written yet, counted down by the
+  // send_token each of them travels in
+  std::atomic<uint32_t> queued_frames{0};
+  // Payload bytes of those frames. For a connection websocketpp frames
+  // itself, the buffered amount admit_send last saw. Readable from any shard
+  std::atomic<uint64_t> queued_bytes{0};
+};
+
+// What happens to a frame for a connection whose send queue is over its limit
+enum class SendPriority : uint8_t {
+  // Replies, member lists and the offer/answer exchange, always queued
+  kHigh = 0,
+  // Candidates, dropped. ICE still completes on the ones that got through
+  kLow,
+};
+
+// Close code of a connection that stopped reading what it is sent
+constexpr websocketpp::close::status::value kCloseSendQueueFull = 4008;
+
+// Random ids tried for a create_transmission without one before it fails
+constexpr int kTransmissionIdAttempts = 16;
+
+// Handshake request that hides a permessage-deflate offer from extension
+// negotiation when the client asks for a dictionary encoding, see
+// on_validate for which subprotocol is picked. Such frames are deflated with
+// the dictionary already, a zlib context would go unused. websocketpp
+// negotiates extensions before the validate handler runs and reads the offer
+// through the config's request type, so the shadowing below takes effect
+struct signal_request : public websocketpp::http::parser::request {
+  bool get_header_as_plist(std::string const& key,
+                           websocketpp::http::parameter_list& out) const;
+};
+
+// Built with SIGNAL_SERVER_IOSTREAM the server runs on websocketpp's
+// iostream transport, connections are fed from memory instead of sockets.
+// tools/signal_replay uses it to play captured traffic back
+#ifdef SIGNAL_SERVER_IOSTREAM
+struct signal_server_config : public websocketpp::config::core {
+#else
+struct signal_server_config : public websocketpp::config::asio {
+#endif
+  typedef connection_data connection_base;
+  typedef signal_request request_type;
+
+  struct permessage_deflate_config {};
+  typedef DeflateExtension<permessage_deflate_config> permessage_deflate_type;
+};
+
+typedef websocketpp::server<signal_server_config> server;
+typedef websocketpp::lib::asio::io_service::strand strand;
+
+// Frames of one outgoing message. A frame is built the first time a
+// recipient needs its encoding and compression and then shared by every
+// recipient that needs the same, so a message is transcoded at most once per
+// encoding and compressed at most once per window size
+class frame_cache {
+ public:
+  explicit frame_cache(const json& message);
+  // frame is a prepared JSON text frame
+  explicit frame_cache(server::message_ptr frame);
+
+  // deflate_bits of 0 gives the uncompressed frame
+  const server::message_ptr& get(WireEncoding encoding, int deflate_bits = 0);
+
+  // Builds an unmasked frame with its header already encoded. The frame is
+  // only read while being written, so any number of connections can share it
+  static server::message_ptr make_frame(
+      std::string payload, websocketpp::frame::opcode::value opcode);
+
+  // Encodes the header of an unmasked frame around the payload of frame,
+  // compressed marks a payload already deflated
+  static void prepare_frame(const server::message_ptr& frame,
+                            websocketpp::frame::opcode::value opcode,
+                            bool compressed = false);
+
+ private:
+  const json* message_ = nullptr;
+  // Parsed from the JSON frame when a binary encoding is asked for
+  json parsed_;
+  // Uncompressed frames first, then one per window size from 9 to 15
+  server::message_ptr frames_[kWireEncodingNum][8];
+};
 typedef unsigned int connection_id;
 typedef std::string room_id;
 
+// When a received message passed the stages before its handler
+struct message_timing {
+  // Metrics::NowNs() when the frame arrived and when its fields were scanned
+  int64_t received_ns = 0;
+  int64_t parsed_ns = 0;
+  // Set for the message types whose relay latency is measured
+  LatencyType latency_type = LatencyType::kLatencyTypeNum;
+};
+
 class SignalServer {
  public:
   SignalServer();
+  // Shards share the transmission state and the id space with each other
+  SignalServer(std::shared_ptr<TransmissionManager> transmission_manager,
+               std::shared_ptr<ClientIdGenerator> client_id_generator);
   ~SignalServer();
 
   bool on_open(websocketpp::connection_hdl hdl);
@@ -33,22 +182,243 @@ class SignalServer {
 
   bool on_pong(websocketpp::connection_hdl hdl, std::string s);
 
-  void run(uint16_t port);
+  // Picks the wire encoding from the subprotocols the client offers
+  bool on_validate(websocketpp::connection_hdl hdl);
+
+  // Plain HTTP requests, serves the sdp dictionaries and /metrics
+  void on_http(websocketpp::connection_hdl hdl);
+
+#ifdef SIGNAL_SERVER_IOSTREAM
+  // Starts the timers, the event loop is then driven by poll
+  void start_streams();
+
+  // A connection that reads what is passed to its read_all and drops what
+  // it writes
+  server::connection_ptr create_stream_connection();
+
+  // Runs the handlers that are ready on the calling thread, returns how many
+  size_t poll();
+#else
+  // Runs the asio event loop on thread_num threads, blocks until it stops
+  void run(uint16_t port, unsigned int thread_num = 1);
+
+  // Binds the listening socket with SO_REUSEPORT, so that several shards can
+  // accept on the same port and the kernel balances connections among them
+  void set_reuse_port(bool reuse_port);
+
+  // Pins event loop thread i to core first_cpu + i, -1 leaves them unpinned
+  void set_cpu_affinity(int first_cpu);
+#endif
+
+  // Connections silent for longer than timeout are closed
+  void set_alive_timeout(std::chrono::seconds timeout);
+
+  // Candidates for a client that logged in with the "new_candidates"
+  // feature are held for up to window, or until max_num of them are pending,
+  // and then go out together as one new_candidates message. A zero window
+  // sends every candidate on its own
+  void set_candidate_batching(std::chrono::milliseconds window,
+                              size_t max_num);
+
+  // Records every signaling event to journal, shards may share one. Set it
+  // before run
+  void set_event_journal(std::shared_ptr<EventJournal> journal);
+
+  // Logs the relay latency percentiles of the last interval every interval,
+  // zero turns it off. The histograms are process wide, so one shard is
+  // enough to cover them all. Set it before run
+  void set_latency_log_interval(std::chrono::seconds interval);
+
+  // Captures every connection and inbound frame to trace, shards may share
+  // one. Set it before run
+  void set_trace_writer(std::shared_ptr<TraceWriter> trace);
+
+  // A connection with more than max_bytes or max_frames waiting to be
+  // written loses its low priority frames, with twice that it is closed with
+  // kCloseSendQueueFull. Zero turns a limit off. Frames the connection
+  // compresses with its own deflate context are only held to max_bytes
+  void set_send_queue_limit(size_t max_bytes, size_t max_frames);
 
   void on_message(websocketpp::connection_hdl hdl, server::message_ptr msg);
 
-  void send_msg(websocketpp::connection_hdl hdl, json message);
+  void send_msg(websocketpp::connection_hdl hdl, const json& message);
+
+  // Serializes message once and queues the same prepared frame on every
+  // member, except the one whose user id is except_user_id
+  void broadcast(const std::vector<TransmissionMember>& members,
+                 const json& message, id_handle except_user_id = kInvalidId);
 
  private:
+  connection_id get_connection_id(websocketpp::connection_hdl hdl);
+
+  // Marks the connection as alive, lock free
+  void touch(websocketpp::connection_hdl hdl);
+
+  void on_idle(websocketpp::connection_hdl hdl);
+
+  // Refreshes CoarseClock from the event loop
+  void tick_clock();
+
+  // Starts the clock, the idle checks and the latency log
+  void start_timers();
+
+  // Messages of one transmission are handled in order on the same strand,
+  // unrelated transmissions run in parallel on the worker threads
+  strand& get_strand(std::string_view transmission_id);
+
+  // Runs on the strand of the message, fields point into the payload of msg.
+  // Looks the handler of the message type up in a compile time table
+  void handle_message(websocketpp::connection_hdl hdl, server::message_ptr msg,
+                      const SignalFields& fields, message_timing timing);
+
+  typedef void (SignalServer::*message_handler)(websocketpp::connection_hdl,
+                                                server::message_ptr,
+                                                const SignalFields&,
+                                                const message_timing&);
+
+  void handle_login(websocketpp::connection_hdl hdl, server::message_ptr msg,
+                    const SignalFields& fields, const message_timing& timing);
+
+  void handle_create_transmission(websocketpp::connection_hdl hdl,
+                                  server::message_ptr msg,
+                                  const SignalFields& fields,
+                                  const message_timing& timing);
+
+  // Picks a random transmission id nobody uses and creates the transmission
+  // on the strand of that id, attempts bounds the ids tried
+  void create_transmission_with_new_id(websocketpp::connection_hdl hdl,
+                                       std::string host_id,
+                                       std::string password, int attempts);
+
+  // Binds host_id as the host of a new transmission and replies, on the
+  // strand of transmission_id. False when the id is taken, nothing is sent
+  // then
+  bool create_transmission(websocketpp::connection_hdl hdl,
+                           const std::string& transmission_id,
+                           const std::string& host_id,
+                           const std::string& password);
+
+  void handle_leave_transmission(websocketpp::connection_hdl hdl,
+                                 server::message_ptr msg,
+                                 const SignalFields& fields,
+                                 const message_timing& timing);
+
+  void handle_query_user_id_list(websocketpp::connection_hdl hdl,
+                                 server::message_ptr msg,
+                                 const SignalFields& fields,
+                                 const message_timing& timing);
+
+  // Forwards an offer, answer or candidate from the received bytes, only the
+  // remote_user_id value is rewritten before the frame goes out again
+  void relay_message(websocketpp::connection_hdl hdl, server::message_ptr msg,
+                     const SignalFields& fields, const message_timing& timing);
+
+  // Records the stages of a relayed message, the enqueue stage ends now
+  void record_relay_latency(const message_timing& timing,
+                            int64_t looked_up_ns, int64_t serialized_ns);
+
+  // Logs the latencies recorded since the last call and rearms the timer
+  void log_latencies();
+
+  // Adds a relayed candidate to the pending batch of con, called on the
+  // shard that owns con
+  void batch_candidate(const server::connection_ptr& con,
+                       const std::string& candidate);
+
+  // Sends the pending candidates of con. Callers hold its candidate_mutex,
+  // so batches leave in the order they were filled
+  void flush_candidates(const server::connection_ptr& con);
+
+  // Removes user_id from transmission_id, releasing it when user_id hosts it
+  void release_user(id_handle user_id, id_handle transmission_id);
+
+  // Prometheus text of the counters and of the state of every shard
+  std::string render_metrics();
+
+  struct send_queue_stats {
+    uint64_t bytes = 0;
+    uint64_t max_bytes = 0;
+    uint64_t frames = 0;
+    uint64_t max_frames = 0;
+    // Connections over their send queue limit
+    uint64_t over_limit = 0;
+    uint64_t mailbox_frames = 0;
+  };
+
+  // Adds up what waits in the send queues of the connections this shard
+  // owns, and the frames in its mailbox
+  void collect_send_queues(send_queue_stats* stats);
+
+  // Whether a send queue of bytes and frames is over factor times the limit
+  bool over_send_queue_limit(size_t bytes, size_t frames,
+                             size_t factor = 1) const;
+
+  // Journals an event that only concerns the connection
+  void journal_event(JournalEvent event, const server::connection_ptr& con,
+                     size_t size = 0);
+
+  // Queues the frame of con's encoding on con, or hands it to the shard that
+  // owns con
+  void deliver(const server::connection_ptr& con, frame_cache& frames,
+               SendPriority priority = SendPriority::kHigh);
+
+  void deliver(const server::connection_ptr& con,
+               const server::message_ptr& frame,
+               SendPriority priority = SendPriority::kHigh);
+
+  // Whether a frame of priority may join the send queue of con, applies the
+  // send queue limit
+  bool admit_send(const server::connection_ptr& con, SendPriority priority);
+
+  // Queues a frame for a connection owned by this shard, called from the
+  // other shards. Queued frames are written in batches on our event loop
+  void post_send(server::connection_ptr con, server::message_ptr frame,
+                 SendPriority priority);
+
+  void drain_mailbox();
+
+ private:
+  // Outlives server_, which runs on it
+  websocketpp::lib::asio::io_service io_service_;
   server server_;
   std::map<websocketpp::connection_hdl, connection_id,
            std::owner_less<websocketpp::connection_hdl>>
       ws_connections_;
   unsigned int ws_connection_id_ = 0;
+  std::mutex ws_connections_mutex_;
+  std::vector<std::thread> workers_;
+  std::vector<std::unique_ptr<strand>> strands_;
+  bool reuse_port_ = false;
+  int cpu_affinity_ = -1;
+  std::unique_ptr<TimingWheel> alive_wheel_;
+  std::unique_ptr<websocketpp::lib::asio::steady_timer> clock_timer_;
+  std::chrono::milliseconds candidate_window_;
+  size_t candidate_batch_max_;
+  std::shared_ptr<EventJournal> journal_;
+  std::shared_ptr<TraceWriter> trace_;
+  size_t send_queue_max_bytes_;
+  size_t send_queue_max_frames_;
+  std::chrono::seconds latency_log_interval_{0};
+  std::unique_ptr<websocketpp::lib::asio::steady_timer> latency_timer_;
+  // Histograms as of the last latency log, by type and stage
+  std::vector<LatencySnapshot> logged_latencies_;
+
+ private:
+  struct outbound_msg {
+    server::connection_ptr con;
+    server::message_ptr frame;
+    SendPriority priority;
+  };
+  std::vector<outbound_msg> mailbox_;
+  std::mutex mailbox_mutex_;
 
  private:
-  TransmissionManager transmission_manager_;
-  ClientIdGenerator client_id_generator_;
+  std::shared_ptr<TransmissionManager> transmission_manager_;
+  std::shared_ptr<ClientIdGenerator> client_id_generator_;
+
+  // Every live shard, so that a scrape on any of them covers all
+  inline static std::mutex instances_mutex_;
+  inline static std::vector<SignalServer*> instances_;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,117 @@
+#include "timing_wheel.h"
+
+#include <algorithm>
+
+#include "coarse_clock.h"
+
+TimingWheel::TimingWheel(websocketpp::lib::asio::io_service& io_service,
+                         std::chrono::milliseconds tick, size_t slot_num)
+    : timer_(io_service),
+      tick_(std::max<int64_t>(1, tick.count())),
+      timeout_(0),
+      slots_(std::max<size_t>(1, slot_num)) {}
+
+TimingWheel::~TimingWheel() { Stop(); }
+
+void TimingWheel::SetTimeout(std::chrono::milliseconds timeout) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  timeout_ = timeout;
+}
+
+void TimingWheel::SetExpireHandler(expire_handler handler) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  expire_handler_ = handler;
+}
+
+void TimingWheel::Add(websocketpp::connection_hdl hdl,
+                      const std::atomic<int64_t>* last_active) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Insert({hdl, last_active},
+         last_active->load(std::memory_order_relaxed) + timeout_.count());
+}
+
+void TimingWheel::Start() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (running_) {
+    return;
+  }
+  running_ = true;
+  current_tick_ = CoarseClock::Update() / tick_;
+  ScheduleTick();
+}
+
+void TimingWheel::Stop() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!running_) {
+    return;
+  }
+  running_ = false;
+  websocketpp::lib::asio::error_code ec;
+  timer_.cancel(ec);
+}
+
+void TimingWheel::ScheduleTick() {
+  timer_.expires_after(std::chrono::milliseconds(tick_));
+  timer_.async_wait([this](const websocketpp::lib::asio::error_code& ec) {
+    OnTick(ec);
+  });
+}
+
+void TimingWheel::OnTick(const websocketpp::lib::asio::error_code& ec) {
+  if (ec) {
+    return;
+  }
+
+  int64_t now = CoarseClock::Update();
+  std::vector<websocketpp::connection_hdl> expired;
+  expire_handler handler;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!running_) {
+      return;
+    }
+
+    // Visit every slot passed since the last tick, a late timer never needs
+    // more than one turn of the wheel
+    int64_t now_tick = now / tick_;
+    for (size_t i = 0; i < slots_.size() && current_tick_ < now_tick; ++i) {
+      ++current_tick_;
+      std::vector<Entry> slot;
+      slot.swap(slots_[current_tick_ % slots_.size()]);
+
+      for (auto& entry : slot) {
+        // Closed connections just fall out of the wheel
+        auto con = entry.hdl.lock();
+        if (!con) {
+          continue;
+        }
+
+        int64_t deadline = entry.last_active->load(std::memory_order_relaxed) +
+                           timeout_.count();
+        if (deadline <= now) {
+          expired.push_back(entry.hdl);
+        } else {
+          Insert(std::move(entry), deadline);
+        }
+      }
+    }
+    current_tick_ = now_tick;
+
+    handler = expire_handler_;
+    ScheduleTick();
+  }
+
+  if (handler) {
+    for (auto& hdl : expired) {
+      handler(hdl);
+    }
+  }
+}
+
+void TimingWheel::Insert(Entry entry, int64_t deadline) {
+  int64_t deadline_tick = (deadline + tick_ - 1) / tick_;
+  if (deadline_tick <= current_tick_) {
+    deadline_tick = current_tick_ + 1;
+  }
+  slots_[deadline_tick % slots_.size()].push_back(std::move(entry));
+}
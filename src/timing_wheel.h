@@ -0,0 +1,62 @@
+#ifndef _TIMING_WHEEL_H_
+#define _TIMING_WHEEL_H_
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <websocketpp/common/asio.hpp>
+#include <websocketpp/common/connection_hdl.hpp>
+
+// Hashed timing wheel that expires idle connections. Every connection owns a
+// last active timestamp that the message path refreshes with a relaxed store,
+// the wheel itself is only touched when a connection opens and on its ticks.
+// An entry sits in the slot of the deadline it had when it was last visited,
+// if the connection was active since then it simply moves on to the slot of
+// its new deadline, otherwise it is handed to the expire handler.
+class TimingWheel {
+ public:
+  typedef std::function<void(websocketpp::connection_hdl)> expire_handler;
+
+  TimingWheel(websocketpp::lib::asio::io_service& io_service,
+              std::chrono::milliseconds tick, size_t slot_num);
+  ~TimingWheel();
+
+  void SetTimeout(std::chrono::milliseconds timeout);
+  void SetExpireHandler(expire_handler handler);
+
+  // last_active holds CoarseClock::Now() stamps and must live as long as the
+  // connection hdl points to
+  void Add(websocketpp::connection_hdl hdl,
+           const std::atomic<int64_t>* last_active);
+
+  void Start();
+  void Stop();
+
+ private:
+  struct Entry {
+    websocketpp::connection_hdl hdl;
+    const std::atomic<int64_t>* last_active;
+  };
+
+  void ScheduleTick();
+  void OnTick(const websocketpp::lib::asio::error_code& ec);
+  // Callers must hold mutex_
+  void Insert(Entry entry, int64_t deadline);
+
+ private:
+  websocketpp::lib::asio::steady_timer timer_;
+  const int64_t tick_;
+  std::chrono::milliseconds timeout_;
+  expire_handler expire_handler_;
+
+  std::mutex mutex_;
+  std::vector<std::vector<Entry>> slots_;
+  // Last tick whose slot has been visited
+  int64_t current_tick_ = 0;
+  bool running_ = false;
+};
+
+#endif
@@ -0,0 +1,133 @@
+#include "trace_file.h"
+
+#include <cerrno>
+#include <cstring>
+
+#include "coarse_clock.h"
+#include "log.h"
+
+namespace {
+constexpr size_t kBufferSize = 1 << 20;
+constexpr int64_t kFlushIntervalMs = 1000;
+}  // namespace
+
+TraceWriter::TraceWriter(FILE* file)
+    : file_(file),
+      start_us_(std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::system_clock::now().time_since_epoch())
+                    .count()),
+      start_(std::chrono::steady_clock::now()) {
+  buffer_.reserve(kBufferSize);
+  spare_.reserve(kBufferSize);
+  flushed_ms_.store(CoarseClock::Now(), std::memory_order_relaxed);
+}
+
+TraceWriter::~TraceWriter() {
+  Flush();
+  std::fclose(file_);
+}
+
+std::shared_ptr<TraceWriter> TraceWriter::Open(const std::string& path) {
+  FILE* file = std::fopen(path.c_str(), "wb");
+  if (!file) {
+    LOG_ERROR("Open trace [{}] failed, errno [{}]", path, errno);
+    return nullptr;
+  }
+
+  TraceHeader header = {};
+  std::memcpy(header.magic, kTraceMagic, sizeof(header.magic));
+  header.version = kTraceVersion;
+  if (1 != std::fwrite(&header, sizeof(header), 1, file) ||
+      0 != std::fflush(file)) {
+    LOG_ERROR("Write trace [{}] failed, errno [{}]", path, errno);
+    std::fclose(file);
+    return nullptr;
+  }
+  LOG_INFO("Capture inbound traffic to [{}]", path);
+  return std::shared_ptr<TraceWriter>(new TraceWriter(file));
+}
+
+void TraceWriter::Write(TraceKind kind, uint32_t connection, uint8_t opcode,
+                        std::string_view payload) {
+  TraceRecord record = {};
+  record.connection = connection;
+  record.size = static_cast<uint32_t>(payload.size());
+  record.kind = kind;
+  record.opcode = opcode;
+
+  if (failed_.load(std::memory_order_relaxed)) {
+    return;
+  }
+  std::unique_lock<std::mutex> lock(buffer_mutex_);
+  // Stamped under the lock so the records of the file are in time order,
+  // replays pace by it
+  record.timestamp_us =
+      start_us_ + std::chrono::duration_cast<std::chrono::microseconds>(
+                      std::chrono::steady_clock::now() - start_)
+                      .count();
+  buffer_.append(reinterpret_cast<const char*>(&record), sizeof(record));
+  buffer_.append(payload.data(), payload.size());
+  if (buffer_.size() >= kBufferSize) {
+    WriteOut(&lock);
+  }
+}
+
+void TraceWriter::FlushIfDue(int64_t now_ms) {
+  int64_t flushed_ms = flushed_ms_.load(std::memory_order_relaxed);
+  // One of the event loops that find the flush due does it
+  if (now_ms - flushed_ms < kFlushIntervalMs ||
+      !flushed_ms_.compare_exchange_strong(flushed_ms, now_ms,
+                                           std::memory_order_relaxed)) {
+    return;
+  }
+  Flush();
+}
+
+void TraceWriter::Flush() {
+  std::unique_lock<std::mutex> lock(buffer_mutex_);
+  WriteOut(&lock);
+}
+
+void TraceWriter::WriteOut(std::unique_lock<std::mutex>* buffer_lock) {
+  std::lock_guard<std::mutex> file_lock(file_mutex_);
+  spare_.swap(buffer_);
+  buffer_lock->unlock();
+
+  if (!spare_.empty() && !failed_.load(std::memory_order_relaxed) &&
+      (spare_.size() !=
+           std::fwrite(spare_.data(), 1, spare_.size(), file_) ||
+       0 != std::fflush(file_))) {
+    LOG_ERROR("Write trace failed, errno [{}], the capture ends here", errno);
+    failed_.store(true, std::memory_order_relaxed);
+  }
+  spare_.clear();
+}
+
+TraceReader::TraceReader(FILE* file) : file_(file) {}
+
+TraceReader::~TraceReader() { std::fclose(file_); }
+
+std::unique_ptr<TraceReader> TraceReader::Open(const std::string& path) {
+  FILE* file = std::fopen(path.c_str(), "rb");
+  if (!file) {
+    return nullptr;
+  }
+
+  TraceHeader header;
+  if (1 != std::fread(&header, sizeof(header), 1, file) ||
+      0 != std::memcmp(header.magic, kTraceMagic, sizeof(kTraceMagic)) ||
+      kTraceVersion != header.version) {
+    std::fclose(file);
+    return nullptr;
+  }
+  return std::unique_ptr<TraceReader>(new TraceReader(file));
+}
+
+bool TraceReader::Next(TraceRecord* record, std::string* payload) {
+  if (1 != std::fread(record, sizeof(*record), 1, file_)) {
+    return false;
+  }
+  payload->resize(record->size);
+  return record->size ==
+         std::fread(payload->data(), 1, record->size, file_);
+}
@@ -0,0 +1,115 @@
+#ifndef _TRACE_FILE_H_
+#define _TRACE_FILE_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+enum class TraceKind : uint8_t {
+  kNone = 0,
+  kOpen,
+  kMessage,
+  kClose,
+};
+
+// Every record is followed by size payload bytes: the negotiated subprotocol
+// of an open, the frame payload of a message as websocketpp delivered it,
+// that is already inflated, and nothing for a close
+struct TraceRecord {
+  // Microseconds since the epoch. Taken from the steady clock against the
+  // wall time the capture started at, so it never steps back
+  int64_t timestamp_us;
+  uint32_t connection;
+  uint32_t size;
+  TraceKind kind;
+  // websocketpp::frame::opcode of a message
+  uint8_t opcode;
+  uint8_t reserved[6];
+};
+static_assert(sizeof(TraceRecord) == 24, "Trace records are 24 bytes");
+
+// Header at the start of a trace file
+struct TraceHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+};
+static_assert(sizeof(TraceHeader) == 16, "Trace headers are 16 bytes");
+
+constexpr char kTraceMagic[8] = {'S', 'I', 'G', 'T', 'R', 'C', 'E', '\0'};
+constexpr uint32_t kTraceVersion = 1;
+
+// Captures the connections and inbound frames of a server into a file, see
+// tools/signal_replay for playing it back. Writers only copy their record
+// into a memory buffer under a short lock. A full buffer is swapped for a
+// spare one and written by the thread that filled it while the others go on
+// appending, and the event loop flushes it about once a second, so a killed
+// server loses at most the last second of its capture.
+class TraceWriter {
+ public:
+  // Writes out what is still buffered
+  ~TraceWriter();
+
+  // Returns nullptr when the file cannot be created
+  static std::shared_ptr<TraceWriter> Open(const std::string& path);
+
+  // Ids for the connections in the trace, unique across the shards that
+  // share the writer and never 0
+  uint32_t NextConnection() { return next_connection_.fetch_add(1) + 1; }
+
+  void Write(TraceKind kind, uint32_t connection, uint8_t opcode,
+             std::string_view payload);
+
+  // Writes out the buffer when the last flush is a second older than now_ms,
+  // a CoarseClock time. Event loops of every shard may call it
+  void FlushIfDue(int64_t now_ms);
+
+  void Flush();
+
+ private:
+  explicit TraceWriter(FILE* file);
+
+  // Hands buffer_ to the file, buffer_lock is released once it is swapped
+  void WriteOut(std::unique_lock<std::mutex>* buffer_lock);
+
+ private:
+  // Guards buffer_
+  std::mutex buffer_mutex_;
+  std::string buffer_;
+  // Guards file_ and spare_, taken before buffer_mutex_ is released so
+  // buffers reach the file in the order they were filled
+  std::mutex file_mutex_;
+  std::string spare_;
+  FILE* file_;
+  // Set by the first failed write, the capture ends there
+  std::atomic<bool> failed_{false};
+  std::atomic<int64_t> flushed_ms_{0};
+  std::atomic<uint32_t> next_connection_{0};
+  // Wall time of start_, the base of record timestamps
+  int64_t start_us_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+class TraceReader {
+ public:
+  ~TraceReader();
+
+  // Returns nullptr when path is not a trace of this version
+  static std::unique_ptr<TraceReader> Open(const std::string& path);
+
+  // False at the end of the trace, or at a record that was cut short
+  bool Next(TraceRecord* record, std::string* payload);
+
+ private:
+  explicit TraceReader(FILE* file);
+
+ private:
+  FILE* file_;
+};
+
+#endif
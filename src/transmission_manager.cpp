@@ -1,158 +1,226 @@
 #include "transmission_manager.h"
 
+#include <algorithm>
+#include <cassert>
+
 #include "log.h"
 
-TransmissionManager::TransmissionManager() {
-  std::thread t(&TransmissionManager::AliveChecker, this);
-  ws_hdl_alive_checker_ = std::move(t);
+namespace {
+const void* ConnectionKey(const websocketpp::connection_hdl& hdl) {
+  return hdl.lock().get();
 }
+}  // namespace
 
-TransmissionManager::~TransmissionManager() {
-  if (ws_hdl_alive_checker_.joinable()) {
-    ws_hdl_alive_checker_.join();
-  }
-}
+TransmissionManager::TransmissionManager() {}
 
-bool TransmissionManager::IsTransmissionExist(
-    const std::string& transmission_id) {
-  if (transmission_host_id_list_.find(transmission_id) !=
-      transmission_host_id_list_.end()) {
+TransmissionManager::~TransmissionManager() {}
+
+bool TransmissionManager::IsTransmissionExist(id_handle transmission_id) {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  auto it = transmission_list_.find(transmission_id);
+  if (it != transmission_list_.end() &&
+      it->second.host.user_id != kInvalidId) {
     return true;
   } else {
     return false;
   }
 }
 
-bool TransmissionManager::ReleaseTransmission(
-    const std::string& transmission_id) {
-  std::lock_guard<std::recursive_mutex> lock(ws_hdl_alive_checker_mutex_);
-  if (transmission_guest_id_list_.end() !=
-      transmission_guest_id_list_.find(transmission_id)) {
-    auto guest_id_list = transmission_guest_id_list_[transmission_id];
-    for (auto& guest_id : guest_id_list) {
-      auto hdl = GetWsHandle(guest_id);
-      if (ws_hdl_iter_list_.find(hdl) != ws_hdl_iter_list_.end()) {
-        auto iter = ws_hdl_iter_list_[hdl];
-        ws_hdl_last_active_time_list_.erase(iter);
-        ws_hdl_iter_list_.erase(hdl);
+bool TransmissionManager::ReleaseTransmission(id_handle transmission_id) {
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  auto it = transmission_list_.find(transmission_id);
+  if (transmission_list_.end() != it) {
+    Transmission& transmission = it->second;
+    for (auto& guest : transmission.guests) {
+      guest_transmission_id_list_.erase(guest.user_id);
+      ReleaseId(guest.user_id);
+    }
+
+    if (transmission.host.user_id != kInvalidId) {
+      auto range = host_transmission_id_list_.equal_range(
+          transmission.host.user_id);
+      for (auto host_it = range.first; host_it != range.second; ++host_it) {
+        if (host_it->second == transmission_id) {
+          host_transmission_id_list_.erase(host_it);
+          break;
+        }
       }
+      ReleaseId(transmission.host.user_id);
     }
 
-    transmission_guest_id_list_.erase(transmission_id);
+    EraseTransmission(it);
   }
+  CheckConsistency();
 
-  if (transmission_host_id_list_.end() !=
-      transmission_host_id_list_.find(transmission_id)) {
-    auto host_id = transmission_host_id_list_[transmission_id];
-    auto hdl = GetWsHandle(host_id);
-    if (ws_hdl_iter_list_.find(hdl) != ws_hdl_iter_list_.end()) {
-      auto iter = ws_hdl_iter_list_[hdl];
-      ws_hdl_last_active_time_list_.erase(iter);
-      ws_hdl_iter_list_.erase(hdl);
-    }
-    transmission_host_id_list_.erase(transmission_id);
+  return true;
+}
+
+std::vector<size_t> TransmissionManager::GetGuestNumOfTransmissions() {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  std::vector<size_t> guest_nums;
+  guest_nums.reserve(transmission_list_.size());
+  for (const auto& transmission : transmission_list_) {
+    guest_nums.push_back(transmission.second.guests.size());
   }
+  return guest_nums;
+}
 
-  if (transmission_password_list_.end() !=
-      transmission_password_list_.find(transmission_id)) {
-    transmission_password_list_.erase(transmission_id);
+id_handle TransmissionManager::IsHost(id_handle user_id) {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  auto it = host_transmission_id_list_.find(user_id);
+  if (it != host_transmission_id_list_.end()) {
+    return it->second;
+  } else {
+    return kInvalidId;
   }
+}
 
-  return true;
+std::vector<id_handle> TransmissionManager::GetTransmissionsOfUser(
+    id_handle user_id) {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  std::vector<id_handle> transmission_id_list;
+  auto range = host_transmission_id_list_.equal_range(user_id);
+  for (auto it = range.first; it != range.second; ++it) {
+    transmission_id_list.push_back(it->second);
+  }
+  auto guest_it = guest_transmission_id_list_.find(user_id);
+  if (guest_it != guest_transmission_id_list_.end()) {
+    transmission_id_list.push_back(guest_it->second);
+  }
+  return transmission_id_list;
 }
 
-std::string TransmissionManager::IsHost(const std::string& user_id) {
-  if (transmission_host_id_list_.find(user_id) !=
-      transmission_host_id_list_.end()) {
-    return transmission_host_id_list_[user_id];
+id_handle TransmissionManager::IsGuest(id_handle user_id) {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  auto it = guest_transmission_id_list_.find(user_id);
+  if (it != guest_transmission_id_list_.end()) {
+    return it->second;
   } else {
-    return "";
+    return kInvalidId;
   }
 }
 
-std::string TransmissionManager::IsGuest(const std::string& user_id) {
-  for (auto& transmission_id : transmission_guest_id_list_) {
-    auto guest_id_list = transmission_id.second;
-    for (auto& guest_id : guest_id_list) {
-      if (guest_id == user_id) {
-        return transmission_id.first;
-      }
+std::vector<id_handle> TransmissionManager::GetAllUserIdOfTransmission(
+    id_handle transmission_id) {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  std::vector<id_handle> user_id_list;
+  auto it = transmission_list_.find(transmission_id);
+  if (it != transmission_list_.end()) {
+    const Transmission& transmission = it->second;
+    user_id_list.reserve(transmission.guests.size() + 1);
+    if (transmission.host.user_id != kInvalidId) {
+      user_id_list.push_back(transmission.host.user_id);
+    }
+    for (auto& guest : transmission.guests) {
+      user_id_list.push_back(guest.user_id);
     }
   }
 
-  return "";
+  return user_id_list;
 }
 
-std::vector<std::string> TransmissionManager::GetAllUserIdOfTransmission(
-    const std::string& transmission_id) {
-  std::vector<std::string> user_id_list;
-  if (transmission_host_id_list_.find(transmission_id) !=
-      transmission_host_id_list_.end()) {
-    auto host_id = transmission_host_id_list_[transmission_id];
-    user_id_list.push_back(host_id);
-  }
-
-  if (transmission_guest_id_list_.find(transmission_id) !=
-      transmission_guest_id_list_.end()) {
-    auto guest_id_list = transmission_guest_id_list_[transmission_id];
-    user_id_list.insert(user_id_list.end(), guest_id_list.begin(),
-                        guest_id_list.end());
+std::vector<TransmissionMember>
+TransmissionManager::GetAllMemberOfTransmission(id_handle transmission_id) {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  std::vector<TransmissionMember> member_list;
+  auto it = transmission_list_.find(transmission_id);
+  if (it != transmission_list_.end()) {
+    const Transmission& transmission = it->second;
+    member_list.reserve(transmission.guests.size() + 1);
+    if (transmission.host.user_id != kInvalidId) {
+      member_list.push_back(transmission.host);
+    }
+    member_list.insert(member_list.end(), transmission.guests.begin(),
+                       transmission.guests.end());
   }
 
-  return user_id_list;
+  return member_list;
 }
 
 bool TransmissionManager::BindHostToTransmission(
-    const std::string& host_id, const std::string& transmission_id) {
-  if (transmission_host_id_list_.find(transmission_id) ==
-      transmission_host_id_list_.end()) {
-    transmission_host_id_list_[transmission_id] = host_id;
-    LOG_INFO("Bind host id [{}] to transmission [{}]", host_id,
-             transmission_id);
+    id_handle host_id, id_handle transmission_id) {
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  auto trans_it = EmplaceTransmission(transmission_id);
+  if (transmission_list_.end() == trans_it) {
+    return false;
+  }
+  Transmission& transmission = trans_it->second;
+  if (transmission.host.user_id == kInvalidId) {
+    transmission.host.user_id = host_id;
+    transmission.host.hdl = FindWsHandle(host_id);
+    host_transmission_id_list_.emplace(host_id, transmission_id);
+    RetainId(host_id);
+    CheckConsistency();
+    LOG_INFO("Bind host id [{}] to transmission [{}]", IdToString(host_id),
+             IdToString(transmission_id));
     return true;
   } else {
-    LOG_WARN("Host id [{}] already bind to transmission [{}]", host_id,
-             transmission_id);
+    LOG_WARN("Host id [{}] already bind to transmission [{}]",
+             IdToString(host_id), IdToString(transmission_id));
+    EraseIfEmpty(trans_it);
     return false;
   }
   return true;
 }
 
 bool TransmissionManager::BindGuestToTransmission(
-    const std::string& guest_id, const std::string& transmission_id) {
-  if (transmission_guest_id_list_.find(transmission_id) ==
-      transmission_guest_id_list_.end()) {
-    transmission_guest_id_list_[transmission_id].push_back(guest_id);
-    LOG_INFO("Bind guest id [{}] to transmission [{}]", guest_id,
-             transmission_id);
-    return true;
-  } else {
-    auto guest_id_list = transmission_guest_id_list_[transmission_id];
-    for (auto id : guest_id_list) {
-      if (id == guest_id) {
-        LOG_WARN("Guest id [{}] already bind to transmission [{}]", guest_id,
-                 transmission_id);
-        return false;
-      }
+    id_handle guest_id, id_handle transmission_id) {
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  // Taken before a move drops the reference of the old binding, which may be
+  // the last one. The caller found the id without a reference, it may be
+  // gone since
+  if (!TryRetainId(guest_id)) {
+    LOG_WARN("Guest id [{:#x}] is released, not bound",
+             static_cast<uint64_t>(guest_id));
+    return false;
+  }
+  // Before leaving the old transmission, so a failure leaves the guest there
+  auto trans_it = EmplaceTransmission(transmission_id);
+  if (transmission_list_.end() == trans_it) {
+    ReleaseId(guest_id);
+    return false;
+  }
+  auto it = guest_transmission_id_list_.find(guest_id);
+  if (it != guest_transmission_id_list_.end()) {
+    if (it->second == transmission_id) {
+      ReleaseId(guest_id);
+      LOG_WARN("Guest id [{}] already bind to transmission [{}]",
+               IdToString(guest_id), IdToString(transmission_id));
+      return false;
     }
-    transmission_guest_id_list_[transmission_id].push_back(guest_id);
-    LOG_INFO("Bind guest id [{}]  to transmission [{}]", guest_id,
-             transmission_id);
+
+    // a guest joins one transmission at a time
+    LOG_WARN("Guest id [{}] moves from transmission [{}] to [{}]",
+             IdToString(guest_id), IdToString(it->second),
+             IdToString(transmission_id));
+    EraseGuest(guest_id);
   }
+
+  trans_it->second.guests.push_back({guest_id, FindWsHandle(guest_id)});
+  guest_transmission_id_list_[guest_id] = transmission_id;
+  CheckConsistency();
+  LOG_INFO("Bind guest id [{}] to transmission [{}]", IdToString(guest_id),
+           IdToString(transmission_id));
   return true;
 }
 
 bool TransmissionManager::BindPasswordToTransmission(
-    const std::string& password, const std::string& transmission_id) {
-  if (transmission_password_list_.find(transmission_id) ==
-      transmission_password_list_.end()) {
-    transmission_password_list_[transmission_id] = password;
+    const std::string& password, id_handle transmission_id) {
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  auto trans_it = EmplaceTransmission(transmission_id);
+  if (transmission_list_.end() == trans_it) {
+    return false;
+  }
+  Transmission& transmission = trans_it->second;
+  if (!transmission.has_password) {
+    transmission.password = password;
+    transmission.has_password = true;
     // LOG_INFO("Bind password [{}]  to transmission [{}]", password,
     //          transmission_id);
     return true;
   } else {
-    auto old_password = transmission_password_list_[transmission_id];
-    transmission_password_list_[transmission_id] = password;
+    auto old_password = transmission.password;
+    transmission.password = password;
     // LOG_WARN("Update password [{}]  to [{}] for transmission [{}]",
     //          old_password, password, transmission_id);
     return true;
@@ -161,183 +229,252 @@ bool TransmissionManager::BindPasswordToTransmission(
   return false;
 }
 
-bool TransmissionManager::BindUserToWsHandle(const std::string& user_id,
+bool TransmissionManager::BindUserToWsHandle(id_handle user_id,
                                              websocketpp::connection_hdl hdl) {
-  if (user_id_ws_hdl_list_.find(user_id) != user_id_ws_hdl_list_.end()) {
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  auto user_it = user_id_ws_hdl_list_.find(user_id);
+  if (user_it != user_id_ws_hdl_list_.end()) {
     LOG_WARN("User id [{}] already bind to websocket handle [{} | now {}]",
-             user_id, user_id_ws_hdl_list_[user_id].lock().get(),
+             IdToString(user_id), user_it->second.lock().get(),
              hdl.lock().get());
     return false;
-  } else {
-    user_id_ws_hdl_list_[user_id] = hdl;
   }
+
+  // one user per connection, a second login replaces the previous user
+  const void* key = ConnectionKey(hdl);
+  auto it = ws_hdl_user_id_list_.find(key);
+  if (it != ws_hdl_user_id_list_.end()) {
+    LOG_WARN("Websocket handle [{}] rebind from user id [{}] to [{}]", key,
+             IdToString(it->second), IdToString(user_id));
+    user_id_ws_hdl_list_.erase(it->second);
+    SetMemberWsHandle(it->second, websocketpp::connection_hdl());
+    ReleaseId(it->second);
+  }
+
+  user_id_ws_hdl_list_[user_id] = hdl;
+  ws_hdl_user_id_list_[key] = user_id;
+  RetainId(user_id);
+  SetMemberWsHandle(user_id, hdl);
+  CheckConsistency();
   return true;
 }
 
-std::string TransmissionManager::ReleaseUserFromeWsHandle(
+id_handle TransmissionManager::ReleaseUserFromeWsHandle(
     websocketpp::connection_hdl hdl) {
-  std::string user_id;
-  for (auto it = user_id_ws_hdl_list_.begin(); it != user_id_ws_hdl_list_.end();
-       ++it) {
-    if (it->second.lock().get() == hdl.lock().get()) {
-      user_id = it->first;
-      user_id_ws_hdl_list_.erase(it);
-      break;
-    }
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  id_handle user_id = kInvalidId;
+  auto it = ws_hdl_user_id_list_.find(ConnectionKey(hdl));
+  if (it != ws_hdl_user_id_list_.end()) {
+    user_id = it->second;
+    ws_hdl_user_id_list_.erase(it);
+    user_id_ws_hdl_list_.erase(user_id);
+    SetMemberWsHandle(user_id, websocketpp::connection_hdl());
+    CheckConsistency();
   }
 
   return user_id;
 }
 
 bool TransmissionManager::IsHostOfTransmission(
-    const std::string& user_id, const std::string& transmission_id) {
-  if (transmission_host_id_list_.find(transmission_id) ==
-      transmission_host_id_list_.end()) {
+    id_handle user_id, id_handle transmission_id) {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  auto it = transmission_list_.find(transmission_id);
+  if (it == transmission_list_.end()) {
     return false;
   }
-  return transmission_host_id_list_[transmission_id] == user_id;
+  return it->second.host.user_id == user_id;
 }
 
-bool TransmissionManager::ReleaseGuestFromTransmission(
-    const std::string& guest_id) {
-  for (auto trans_it = transmission_guest_id_list_.begin();
-       trans_it != transmission_guest_id_list_.end(); ++trans_it) {
-    auto& guest_id_list = trans_it->second;
-    auto guest_id_it =
-        std::find(guest_id_list.begin(), guest_id_list.end(), guest_id);
-    if (guest_id_it != guest_id_list.end()) {
-      // LOG_INFO("Remove guest id [{}] from transmission [{}]", guest_id,
-      //          trans_it->first);
-      guest_id_list.erase(guest_id_it);
-      return true;
-    }
+bool TransmissionManager::ReleaseGuestFromTransmission(id_handle guest_id) {
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  if (EraseGuest(guest_id)) {
+    CheckConsistency();
+    return true;
   }
 
-  LOG_ERROR("Guest id [{}] not found in transmission list", guest_id);
+  LOG_ERROR("Guest id [{}] not found in transmission list",
+            IdToString(guest_id));
 
   return false;
 }
 
+bool TransmissionManager::EraseGuest(id_handle guest_id) {
+  auto it = guest_transmission_id_list_.find(guest_id);
+  if (it == guest_transmission_id_list_.end()) {
+    return false;
+  }
+
+  auto trans_it = transmission_list_.find(it->second);
+  if (trans_it != transmission_list_.end()) {
+    auto& guests = trans_it->second.guests;
+    for (auto guest_it = guests.begin(); guest_it != guests.end();
+         ++guest_it) {
+      if (guest_it->user_id == guest_id) {
+        // LOG_INFO("Remove guest id [{}] from transmission [{}]", guest_id,
+        //          trans_it->first);
+        guests.erase(guest_it);
+        break;
+      }
+    }
+    EraseIfEmpty(trans_it);
+  }
+
+  guest_transmission_id_list_.erase(it);
+  ReleaseId(guest_id);
+  return true;
+}
+
+// Guests may reference a transmission nobody hosts, drop it once they left
+void TransmissionManager::EraseIfEmpty(
+    std::unordered_map<id_handle, Transmission>::iterator it) {
+  const Transmission& transmission = it->second;
+  if (transmission.host.user_id == kInvalidId && transmission.guests.empty() &&
+      !transmission.has_password) {
+    EraseTransmission(it);
+  }
+}
+
+std::unordered_map<id_handle, Transmission>::iterator
+TransmissionManager::EmplaceTransmission(id_handle transmission_id) {
+  auto found = transmission_list_.find(transmission_id);
+  if (transmission_list_.end() != found) {
+    return found;
+  }
+  // A handle found without a reference may be stale, nothing to key by then
+  if (!TryRetainId(transmission_id)) {
+    LOG_WARN("Transmission id [{:#x}] is released, not bound",
+             static_cast<uint64_t>(transmission_id));
+    return transmission_list_.end();
+  }
+  return transmission_list_.try_emplace(transmission_id).first;
+}
+
+void TransmissionManager::EraseTransmission(
+    std::unordered_map<id_handle, Transmission>::iterator it) {
+  id_handle transmission_id = it->first;
+  transmission_list_.erase(it);
+  ReleaseId(transmission_id);
+}
+
 bool TransmissionManager::ReleasePasswordFromTransmission(
-    const std::string& transmission_id) {
-  if (transmission_password_list_.end() ==
-      transmission_password_list_.find(transmission_id)) {
-    LOG_ERROR("No transmission with id [{}]", transmission_id);
+    id_handle transmission_id) {
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  auto it = transmission_list_.find(transmission_id);
+  if (transmission_list_.end() == it || !it->second.has_password) {
+    LOG_ERROR("No transmission with id [{}]", IdToString(transmission_id));
     return false;
   }
 
-  transmission_password_list_.erase(transmission_id);
+  it->second.password.clear();
+  it->second.has_password = false;
+  EraseIfEmpty(it);
 
   return true;
 }
 
 websocketpp::connection_hdl TransmissionManager::GetWsHandle(
-    const std::string& user_id) {
-  if (user_id_ws_hdl_list_.find(user_id) != user_id_ws_hdl_list_.end()) {
-    return user_id_ws_hdl_list_[user_id];
+    id_handle user_id) {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  return FindWsHandle(user_id);
+}
+
+websocketpp::connection_hdl TransmissionManager::FindWsHandle(
+    id_handle user_id) {
+  auto it = user_id_ws_hdl_list_.find(user_id);
+  if (it != user_id_ws_hdl_list_.end()) {
+    return it->second;
   } else {
     websocketpp::connection_hdl hdl;
     return hdl;
   }
 }
 
-std::string TransmissionManager::GetUserId(websocketpp::connection_hdl hdl) {
-  for (auto it = user_id_ws_hdl_list_.begin(); it != user_id_ws_hdl_list_.end();
-       ++it) {
-    if (it->second.lock().get() == hdl.lock().get()) return it->first;
+void TransmissionManager::SetMemberWsHandle(id_handle user_id,
+                                            websocketpp::connection_hdl hdl) {
+  auto range = host_transmission_id_list_.equal_range(user_id);
+  for (auto host_it = range.first; host_it != range.second; ++host_it) {
+    transmission_list_[host_it->second].host.hdl = hdl;
+  }
+
+  auto guest_it = guest_transmission_id_list_.find(user_id);
+  if (guest_it != guest_transmission_id_list_.end()) {
+    for (auto& guest : transmission_list_[guest_it->second].guests) {
+      if (guest.user_id == user_id) {
+        guest.hdl = hdl;
+        break;
+      }
+    }
   }
-  return "";
+}
+
+id_handle TransmissionManager::GetUserId(websocketpp::connection_hdl hdl) {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  auto it = ws_hdl_user_id_list_.find(ConnectionKey(hdl));
+  if (it != ws_hdl_user_id_list_.end()) {
+    return it->second;
+  }
+  return kInvalidId;
 }
 
 int TransmissionManager::CheckPassword(const std::string& password,
-                                       const std::string& transmission_id) {
-  if (transmission_password_list_.find(transmission_id) ==
-      transmission_password_list_.end()) {
-    LOG_ERROR("No transmission with id [{}]", transmission_id);
+                                       id_handle transmission_id) {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  auto it = transmission_list_.find(transmission_id);
+  if (it == transmission_list_.end() || !it->second.has_password) {
+    LOG_ERROR("No transmission with id [{}]", IdToString(transmission_id));
     return -2;
   }
 
-  return transmission_password_list_[transmission_id] == password ? 0 : -1;
+  return it->second.password == password ? 0 : -1;
 }
 
-std::string TransmissionManager::GetPassword(
-    const std::string& transmission_id) {
-  if (transmission_password_list_.find(transmission_id) ==
-      transmission_password_list_.end()) {
-    LOG_ERROR("No transmission with id [{}]", transmission_id);
+std::string TransmissionManager::GetPassword(id_handle transmission_id) {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  auto it = transmission_list_.find(transmission_id);
+  if (it == transmission_list_.end() || !it->second.has_password) {
+    LOG_ERROR("No transmission with id [{}]", IdToString(transmission_id));
     return "";
   }
 
-  return transmission_password_list_[transmission_id];
+  return it->second.password;
 }
 
-/*Lifetime*/
-int TransmissionManager::UpdateWsHandleLastActiveTime(
-    websocketpp::connection_hdl hdl) {
-  // if already record last active time
-  std::lock_guard<std::recursive_mutex> lock(ws_hdl_alive_checker_mutex_);
+// Walks every list, so it only runs in debug builds
+void TransmissionManager::CheckConsistency() {
+#ifndef NDEBUG
+  size_t host_num = 0;
+  size_t guest_num = 0;
+  for (auto& transmission : transmission_list_) {
+    const TransmissionMember& host = transmission.second.host;
+    if (host.user_id != kInvalidId) {
+      auto range = host_transmission_id_list_.equal_range(host.user_id);
+      assert(range.second !=
+             std::find_if(range.first, range.second, [&](const auto& entry) {
+               return entry.second == transmission.first;
+             }));
+      assert(ConnectionKey(host.hdl) ==
+             ConnectionKey(FindWsHandle(host.user_id)));
+      ++host_num;
+    }
 
-  if (ws_hdl_iter_list_.find(hdl) != ws_hdl_iter_list_.end()) {
-    auto it = ws_hdl_iter_list_[hdl];
-    if (it != ws_hdl_last_active_time_list_.end()) {
-      ws_hdl_last_active_time_list_.erase(it);
+    for (auto& guest : transmission.second.guests) {
+      auto it = guest_transmission_id_list_.find(guest.user_id);
+      assert(it != guest_transmission_id_list_.end() &&
+             it->second == transmission.first);
+      assert(ConnectionKey(guest.hdl) ==
+             ConnectionKey(FindWsHandle(guest.user_id)));
+      ++guest_num;
     }
   }
+  assert(host_num == host_transmission_id_list_.size());
+  assert(guest_num == guest_transmission_id_list_.size());
 
-  uint32_t now_time = std::chrono::duration_cast<std::chrono::seconds>(
-                          std::chrono::system_clock::now().time_since_epoch())
-                          .count();
-  ws_hdl_last_active_time_list_.push_front(std::make_pair(hdl, now_time));
-  ws_hdl_iter_list_[hdl] = ws_hdl_last_active_time_list_.begin();
-
-  // LOG_INFO("Update [{}] with time [{}]", hdl.lock().get(), now_time);
-
-  return 0;
-}
-
-void TransmissionManager::AliveChecker() {
-  while (true) {
-    std::this_thread::sleep_for(std::chrono::seconds(10));
-
-    std::lock_guard<std::recursive_mutex> lock(ws_hdl_alive_checker_mutex_);
-    while (!ws_hdl_last_active_time_list_.empty()) {
-      auto hdl = ws_hdl_last_active_time_list_.back().first;
-      if (hdl.expired()) {
-        break;
-      }
-
-      uint32_t now_time =
-          std::chrono::duration_cast<std::chrono::seconds>(
-              std::chrono::system_clock::now().time_since_epoch())
-              .count();
-
-      uint32_t duration =
-          now_time - ws_hdl_last_active_time_list_.back().second;
-
-      bool is_dead = duration > 100000000 ? true : false;
-
-      if (is_dead) {
-        LOG_INFO(
-            "Websocket handle [{}] is dead, now time [{}], last active time "
-            "[{}], duration [{}]",
-            hdl.lock().get(), now_time,
-            ws_hdl_last_active_time_list_.back().second, duration);
-        if (ws_hdl_iter_list_.find(hdl) != ws_hdl_iter_list_.end()) {
-          auto it = ws_hdl_iter_list_[hdl];
-
-          auto user_id = GetUserId(hdl);
-          auto transmission_id = IsHost(user_id);
-          if (transmission_id.empty()) {
-            LOG_INFO("Host [{}|{}] is dead, release transmission [{}]", user_id,
-                     hdl.lock().get(), transmission_id);
-            ReleaseTransmission(transmission_id);
-          }
-          ws_hdl_last_active_time_list_.pop_back();
-          ws_hdl_iter_list_.erase(hdl);
-        }
-      } else {
-        break;
-      }
-    }
+  assert(ws_hdl_user_id_list_.size() == user_id_ws_hdl_list_.size());
+  for (auto& user : ws_hdl_user_id_list_) {
+    auto it = user_id_ws_hdl_list_.find(user.second);
+    assert(it != user_id_ws_hdl_list_.end());
   }
-}
\ No newline at end of file
+  (void)host_num;
+  (void)guest_num;
+#endif
+}
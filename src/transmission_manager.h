@@ -1,72 +1,102 @@
 #ifndef _TRANSIMISSION_MANAGER_H_
 #define _TRANSIMISSION_MANAGER_H_
 
-#include <list>
-#include <map>
 #include <mutex>
-#include <thread>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
 #include <websocketpp/server.hpp>
 
+#include "id_interner.h"
+
+struct TransmissionMember {
+  id_handle user_id = kInvalidId;
+  // Cached copy of the user's handle, refreshed on login and logout
+  websocketpp::connection_hdl hdl;
+};
+
+// Everything known about one transmission, one hash lookup away
+struct Transmission {
+  TransmissionMember host;
+  std::vector<TransmissionMember> guests;
+  std::string password;
+  bool has_password = false;
+};
+
 class TransmissionManager {
  public:
   TransmissionManager();
   ~TransmissionManager();
 
  public:
-  bool IsTransmissionExist(const std::string& transmission_id);
-  bool ReleaseTransmission(const std::string& transmission_id);
+  bool IsTransmissionExist(id_handle transmission_id);
+  bool ReleaseTransmission(id_handle transmission_id);
 
-  std::string IsHost(const std::string& user_id);
-  std::string IsGuest(const std::string& user_id);
-  bool IsHostOfTransmission(const std::string& user_id,
-                            const std::string& transmission_id);
+  // One of the transmissions user_id hosts, a host may have several
+  id_handle IsHost(id_handle user_id);
+  id_handle IsGuest(id_handle user_id);
+  // Every transmission user_id hosts or is a guest of
+  std::vector<id_handle> GetTransmissionsOfUser(id_handle user_id);
+  bool IsHostOfTransmission(id_handle user_id, id_handle transmission_id);
 
  public:
-  std::vector<std::string> GetAllUserIdOfTransmission(
-      const std::string& transmission_id);
+  std::vector<id_handle> GetAllUserIdOfTransmission(id_handle transmission_id);
+  // Host first, then guests in join order, with their handles
+  std::vector<TransmissionMember> GetAllMemberOfTransmission(
+      id_handle transmission_id);
+  // Number of guests of every transmission, for metrics
+  std::vector<size_t> GetGuestNumOfTransmissions();
 
  public:
-  bool BindHostToTransmission(const std::string& host_id,
-                              const std::string& transmission_id);
-  bool BindGuestToTransmission(const std::string& guest_id,
-                               const std::string& transmission_id);
+  bool BindHostToTransmission(id_handle host_id, id_handle transmission_id);
+  bool BindGuestToTransmission(id_handle guest_id, id_handle transmission_id);
   bool BindPasswordToTransmission(const std::string& password,
-                                  const std::string& transmission_id);
-  bool BindUserToWsHandle(const std::string& user_id,
-                          websocketpp::connection_hdl hdl);
-
- public:
-  bool ReleaseGuestFromTransmission(const std::string& guest_id);
-  bool ReleasePasswordFromTransmission(const std::string& transmission_id);
-  std::string ReleaseUserFromeWsHandle(websocketpp::connection_hdl hdl);
+                                  id_handle transmission_id);
+  bool BindUserToWsHandle(id_handle user_id, websocketpp::connection_hdl hdl);
 
  public:
-  websocketpp::connection_hdl GetWsHandle(const std::string& user_id);
-  std::string GetUserId(websocketpp::connection_hdl hdl);
-  int CheckPassword(const std::string& password,
-                    const std::string& transmission_id);
-  std::string GetPassword(const std::string& transmission_id);
+  bool ReleaseGuestFromTransmission(id_handle guest_id);
+  bool ReleasePasswordFromTransmission(id_handle transmission_id);
+  // Returns the user that was bound to hdl. The caller gets the id reference
+  // the binding held and gives it back with ReleaseId
+  id_handle ReleaseUserFromeWsHandle(websocketpp::connection_hdl hdl);
 
  public:
-  int UpdateWsHandleLastActiveTime(websocketpp::connection_hdl hdl);
-  void AliveChecker();
+  websocketpp::connection_hdl GetWsHandle(id_handle user_id);
+  id_handle GetUserId(websocketpp::connection_hdl hdl);
+  int CheckPassword(const std::string& password, id_handle transmission_id);
+  std::string GetPassword(id_handle transmission_id);
 
  private:
-  std::map<std::string, std::string> transmission_host_id_list_;
-  std::map<std::string, std::vector<std::string>> transmission_guest_id_list_;
-  std::map<std::string, std::string> transmission_password_list_;
-  std::map<std::string, websocketpp::connection_hdl> user_id_ws_hdl_list_;
+  // Callers must hold mutex_
+  websocketpp::connection_hdl FindWsHandle(id_handle user_id);
+  // Sets the connection of every membership of user_id
+  void SetMemberWsHandle(id_handle user_id, websocketpp::connection_hdl hdl);
+  bool EraseGuest(id_handle guest_id);
+  void EraseIfEmpty(std::unordered_map<id_handle, Transmission>::iterator it);
+  std::unordered_map<id_handle, Transmission>::iterator EmplaceTransmission(
+      id_handle transmission_id);
+  void EraseTransmission(
+      std::unordered_map<id_handle, Transmission>::iterator it);
+  void CheckConsistency();
 
  private:
-  std::list<std::pair<websocketpp::connection_hdl, uint32_t>>
-      ws_hdl_last_active_time_list_;
-  std::map<
-      websocketpp::connection_hdl,
-      std::list<std::pair<websocketpp::connection_hdl, uint32_t>>::iterator,
-      std::owner_less<websocketpp::connection_hdl>>
-      ws_hdl_iter_list_;
-  std::thread ws_hdl_alive_checker_;
-  std::recursive_mutex ws_hdl_alive_checker_mutex_;
+  // Guards the transmission and user lists below. Lookups on the relay path
+  // take it shared, so sessions on different strands do not serialize.
+  // Every id stored as a key of transmission_list_, user_id_ws_hdl_list_ and
+  // the host and guest lists holds an id reference, see id_interner.h
+  std::shared_mutex mutex_;
+  std::unordered_map<id_handle, Transmission> transmission_list_;
+  std::unordered_map<id_handle, websocketpp::connection_hdl>
+      user_id_ws_hdl_list_;
+
+  // Reverse indexes of the lists above, kept in step by every Bind/Release.
+  // A host may host several transmissions, one entry each
+  std::unordered_multimap<id_handle, id_handle> host_transmission_id_list_;
+  std::unordered_map<id_handle, id_handle> guest_transmission_id_list_;
+  // Keyed by the connection object the handle points to
+  std::unordered_map<const void*, id_handle> ws_hdl_user_id_list_;
 };
 
 #endif
\ No newline at end of file
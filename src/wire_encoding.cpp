@@ -0,0 +1,73 @@
+#include "wire_encoding.h"
+
+#include "sdp_dictionary.h"
+
+// Inflated messages beyond this are rejected as malformed
+constexpr size_t kMaxInflatedSize = 1 << 24;
+
+const char* WireEncodingSubprotocol(WireEncoding encoding) {
+  switch (encoding) {
+    case WireEncoding::kMsgPack:
+      return "signal.msgpack";
+    case WireEncoding::kCbor:
+      return "signal.cbor";
+    case WireEncoding::kSdpDictV1:
+      return "signal.json.sdpdict.v1";
+    default:
+      return "signal.json";
+  }
+}
+
+int WireDictionaryVersion(WireEncoding encoding) {
+  return WireEncoding::kSdpDictV1 == encoding ? 1 : 0;
+}
+
+bool ParseWireSubprotocol(std::string_view subprotocol,
+                          WireEncoding* encoding) {
+  for (size_t i = 0; i < kWireEncodingNum; ++i) {
+    WireEncoding candidate = static_cast<WireEncoding>(i);
+    if (subprotocol == WireEncodingSubprotocol(candidate)) {
+      *encoding = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+std::string EncodeWire(const nlohmann::json& message, WireEncoding encoding) {
+  std::string payload;
+  switch (encoding) {
+    case WireEncoding::kMsgPack:
+      nlohmann::json::to_msgpack(message, payload);
+      break;
+    case WireEncoding::kCbor:
+      nlohmann::json::to_cbor(message, payload);
+      break;
+    case WireEncoding::kSdpDictV1:
+      DeflateWithSdpDictionary(message.dump(), 1, &payload);
+      break;
+    default:
+      payload = message.dump();
+      break;
+  }
+  return payload;
+}
+
+nlohmann::json DecodeWire(const std::string& payload, WireEncoding encoding) {
+  switch (encoding) {
+    case WireEncoding::kMsgPack:
+      return nlohmann::json::from_msgpack(payload);
+    case WireEncoding::kCbor:
+      return nlohmann::json::from_cbor(payload);
+    case WireEncoding::kSdpDictV1: {
+      std::string text;
+      // What cannot be inflated fails to parse as empty input
+      if (!InflateWithSdpDictionary(payload, 1, kMaxInflatedSize, &text)) {
+        text.clear();
+      }
+      return nlohmann::json::parse(text);
+    }
+    default:
+      return nlohmann::json::parse(payload);
+  }
+}
@@ -0,0 +1,35 @@
+#ifndef _WIRE_ENCODING_H_
+#define _WIRE_ENCODING_H_
+
+#include <nlohmann/json.hpp>
+#include <string>
+#include <string_view>
+
+// Encodings a client can pick for its signaling messages through the
+// WebSocket subprotocol of the handshake. Without one, or with an unknown
+// one, the connection speaks JSON text as before. The binary encodings carry
+// the same message objects and are sent as binary frames. kSdpDictV1 is JSON
+// text deflated with version 1 of the preset sdp dictionary, one frame per
+// message, see sdp_dictionary.h. Text frames on such a connection carry plain
+// JSON, in both directions.
+enum class WireEncoding { kJson = 0, kMsgPack, kCbor, kSdpDictV1 };
+
+constexpr size_t kWireEncodingNum = 4;
+
+// Subprotocol names, "signal.json", "signal.msgpack", "signal.cbor" and
+// "signal.json.sdpdict.v1"
+const char* WireEncodingSubprotocol(WireEncoding encoding);
+
+// Version of the sdp dictionary the encoding deflates JSON text with, 0 for
+// encodings that do not
+int WireDictionaryVersion(WireEncoding encoding);
+
+bool ParseWireSubprotocol(std::string_view subprotocol, WireEncoding* encoding);
+
+// Serializes message in the given encoding
+std::string EncodeWire(const nlohmann::json& message, WireEncoding encoding);
+
+// Throws nlohmann::json::exception on malformed input
+nlohmann::json DecodeWire(const std::string& payload, WireEncoding encoding);
+
+#endif
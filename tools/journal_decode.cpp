@@ -0,0 +1,120 @@
+// Decodes event journal files written by signal_server into CSV, or into one
+// JSON object per line.
+//
+// Usage: journal_decode [--json] journal-0.bin [journal-1.bin...]
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "event_journal.h"
+
+namespace {
+
+std::string IdString(const char (&field)[kJournalIdSize]) {
+  return std::string(field, strnlen(field, kJournalIdSize));
+}
+
+// Ids are whatever clients sent, quote them for both outputs
+std::string Quote(const std::string& value, bool json) {
+  std::string quoted = "\"";
+  for (char c : value) {
+    if ('"' == c) {
+      quoted += json ? "\\\"" : "\"\"";
+    } else if (json && '\\' == c) {
+      quoted += "\\\\";
+    } else if (json && static_cast<unsigned char>(c) < 0x20) {
+      char escaped[8];
+      std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      quoted += escaped;
+    } else {
+      quoted += c;
+    }
+  }
+  quoted += '"';
+  return quoted;
+}
+
+bool Decode(const char* path, bool json) {
+  FILE* file = std::fopen(path, "rb");
+  if (!file) {
+    std::fprintf(stderr, "Cannot open %s\n", path);
+    return false;
+  }
+
+  JournalHeader header;
+  if (1 != std::fread(&header, sizeof(header), 1, file) ||
+      0 != std::memcmp(header.magic, kJournalMagic, sizeof(kJournalMagic)) ||
+      kJournalVersion != header.version ||
+      sizeof(JournalRecord) != header.record_size) {
+    std::fprintf(stderr, "%s is not a version %u journal\n", path,
+                 kJournalVersion);
+    std::fclose(file);
+    return false;
+  }
+
+  JournalRecord record;
+  for (uint64_t i = 0; i < header.capacity; ++i) {
+    if (1 != std::fread(&record, sizeof(record), 1, file)) {
+      break;
+    }
+    // Files are preallocated with zeros. A file still being written may
+    // also have a claimed slot whose copy has not landed yet
+    if (0 == record.timestamp_us) {
+      continue;
+    }
+    std::string transmission_id = Quote(IdString(record.transmission_id), json);
+    std::string user_id = Quote(IdString(record.user_id), json);
+    std::string remote_user_id = Quote(IdString(record.remote_user_id), json);
+    if (json) {
+      std::printf(
+          "{\"timestamp_us\":%" PRId64
+          ",\"event\":\"%s\",\"connection\":%u,\"transmission_id\":%s,"
+          "\"user_id\":%s,\"remote_user_id\":%s,\"size\":%u,"
+          "\"latency_us\":%u}\n",
+          record.timestamp_us, JournalEventName(record.event),
+          record.connection, transmission_id.c_str(), user_id.c_str(),
+          remote_user_id.c_str(), record.size, record.latency_us);
+    } else {
+      std::printf("%" PRId64 ",%s,%u,%s,%s,%s,%u,%u\n", record.timestamp_us,
+                  JournalEventName(record.event), record.connection,
+                  transmission_id.c_str(), user_id.c_str(),
+                  remote_user_id.c_str(), record.size, record.latency_us);
+    }
+  }
+  std::fclose(file);
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  bool json = false;
+  std::vector<const char*> paths;
+  for (int i = 1; i < argc; ++i) {
+    if (0 == std::strcmp(argv[i], "--json")) {
+      json = true;
+    } else {
+      paths.push_back(argv[i]);
+    }
+  }
+  if (paths.empty()) {
+    std::fprintf(stderr,
+                 "Usage: journal_decode [--json] journal-0.bin "
+                 "[journal-1.bin...]\n");
+    return 1;
+  }
+
+  if (!json) {
+    std::printf(
+        "timestamp_us,event,connection,transmission_id,user_id,"
+        "remote_user_id,size,latency_us\n");
+  }
+  bool ok = true;
+  for (const char* path : paths) {
+    ok = Decode(path, json) && ok;
+  }
+  return ok ? 0 : 1;
+}
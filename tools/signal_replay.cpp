@@ -0,0 +1,194 @@
+// Plays a trace captured by signal_server back into a SignalServer built on
+// websocketpp's iostream transport: no sockets and no network, the same
+// frames on the same connections in the same order. Handlers run on the
+// calling thread after every record, so a replay is deterministic and can
+// be profiled or compared run against run. Prints the counters and relay
+// latencies of the replay afterwards.
+//
+// Usage: signal_replay [--speed 0] trace_file
+// speed 1 keeps the recorded timing, 2 plays twice as fast, 0 plays as fast
+// as possible.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "signal_server.h"
+#include "trace_file.h"
+
+namespace {
+
+struct ReplayRecord {
+  TraceRecord record;
+  // Bytes to feed the connection: the upgrade request of an open, the
+  // masked client frame of a message
+  std::string bytes;
+};
+
+std::string MakeUpgradeRequest(const std::string& subprotocol) {
+  std::string request =
+      "GET / HTTP/1.1\r\nHost: replay\r\nUpgrade: websocket\r\n"
+      "Connection: Upgrade\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+      "Sec-WebSocket-Version: 13\r\n";
+  if (!subprotocol.empty()) {
+    request += "Sec-WebSocket-Protocol: " + subprotocol + "\r\n";
+  }
+  request += "\r\n";
+  return request;
+}
+
+// Clients have to mask their frames
+std::string MakeClientFrame(websocketpp::frame::opcode::value opcode,
+                            const std::string& payload) {
+  websocketpp::frame::masking_key_type key;
+  key.i = 0x5a17c3e1;
+  websocketpp::frame::basic_header header(opcode, payload.size(), true,
+                                          true);
+  std::string frame = websocketpp::frame::prepare_header(
+      header, websocketpp::frame::extended_header(payload.size(), key.i));
+  size_t offset = frame.size();
+  frame.resize(offset + payload.size());
+  websocketpp::frame::byte_mask(payload.begin(), payload.end(),
+                                frame.begin() + offset, key);
+  return frame;
+}
+
+bool Load(const char* path, std::vector<ReplayRecord>* records) {
+  std::unique_ptr<TraceReader> reader = TraceReader::Open(path);
+  if (!reader) {
+    std::fprintf(stderr, "%s is not a version %u trace\n", path,
+                 kTraceVersion);
+    return false;
+  }
+
+  ReplayRecord replay;
+  std::string payload;
+  while (reader->Next(&replay.record, &payload)) {
+    if (TraceKind::kOpen == replay.record.kind) {
+      replay.bytes = MakeUpgradeRequest(payload);
+    } else if (TraceKind::kMessage == replay.record.kind) {
+      replay.bytes = MakeClientFrame(
+          static_cast<websocketpp::frame::opcode::value>(
+              replay.record.opcode),
+          payload);
+    } else {
+      replay.bytes.clear();
+    }
+    records->push_back(replay);
+  }
+  return true;
+}
+
+void PrintReport(size_t record_num, double seconds) {
+  std::printf("%zu records in %.3f s, %.0f records/s\n", record_num, seconds,
+              record_num / seconds);
+  std::printf(
+      "%llu connections, %llu bytes in, %llu bytes out in %llu frames, "
+      "%llu parse failures\n",
+      static_cast<unsigned long long>(
+          Metrics::Sum(Counter::kConnectionsOpened)),
+      static_cast<unsigned long long>(Metrics::Sum(Counter::kBytesIn)),
+      static_cast<unsigned long long>(Metrics::Sum(Counter::kBytesOut)),
+      static_cast<unsigned long long>(Metrics::Sum(Counter::kFramesOut)),
+      static_cast<unsigned long long>(Metrics::Sum(Counter::kParseFailures)));
+
+  std::printf("%-16s %-10s %8s %10s %10s %10s\n", "type", "stage", "count",
+              "p50 us", "p99 us", "p999 us");
+  for (size_t type = 0;
+       type < static_cast<size_t>(LatencyType::kLatencyTypeNum); ++type) {
+    for (size_t stage = 0;
+         stage < static_cast<size_t>(LatencyStage::kLatencyStageNum);
+         ++stage) {
+      LatencySnapshot latency =
+          Metrics::SnapshotLatency(static_cast<LatencyType>(type),
+                                   static_cast<LatencyStage>(stage));
+      if (0 == latency.count) {
+        continue;
+      }
+      std::printf("%-16s %-10s %8llu %10.1f %10.1f %10.1f\n",
+                  LatencyTypeName(static_cast<LatencyType>(type)),
+                  LatencyStageName(static_cast<LatencyStage>(stage)),
+                  static_cast<unsigned long long>(latency.count),
+                  latency.Percentile(0.5) / 1e3,
+                  latency.Percentile(0.99) / 1e3,
+                  latency.Percentile(0.999) / 1e3);
+    }
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  double speed = 0;
+  const char* path = nullptr;
+  for (int i = 1; i < argc; ++i) {
+    if (0 == std::strcmp(argv[i], "--speed") && i + 1 < argc) {
+      speed = std::strtod(argv[++i], nullptr);
+    } else {
+      path = argv[i];
+    }
+  }
+  if (!path) {
+    std::fprintf(stderr, "Usage: signal_replay [--speed 0] trace_file\n");
+    return 1;
+  }
+
+  // Frames are built up front, the replay only feeds them
+  std::vector<ReplayRecord> records;
+  if (!Load(path, &records)) {
+    return 1;
+  }
+  if (records.empty()) {
+    std::printf("Empty trace\n");
+    return 0;
+  }
+
+  SignalServer server;
+  server.start_streams();
+  std::unordered_map<uint32_t, server::connection_ptr> connections;
+
+  auto begin = std::chrono::steady_clock::now();
+  int64_t first_us = records.front().record.timestamp_us;
+  for (const ReplayRecord& replay : records) {
+    if (speed > 0) {
+      std::this_thread::sleep_until(
+          begin + std::chrono::microseconds(static_cast<int64_t>(
+                      (replay.record.timestamp_us - first_us) / speed)));
+    }
+
+    if (TraceKind::kOpen == replay.record.kind) {
+      server::connection_ptr con = server.create_stream_connection();
+      con->read_all(replay.bytes.data(), replay.bytes.size());
+      connections[replay.record.connection] = con;
+    } else {
+      auto it = connections.find(replay.record.connection);
+      if (connections.end() == it) {
+        continue;
+      }
+      if (TraceKind::kMessage == replay.record.kind) {
+        it->second->read_all(replay.bytes.data(), replay.bytes.size());
+      } else if (TraceKind::kClose == replay.record.kind) {
+        it->second->eof();
+        connections.erase(it);
+      }
+    }
+    server.poll();
+  }
+
+  // Connections the capture ended with are closed like dropped sockets
+  for (auto& connection : connections) {
+    connection.second->eof();
+  }
+  server.poll();
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - begin)
+                       .count();
+
+  PrintReport(records.size(), seconds);
+  return 0;
+}
@@ -6,7 +6,7 @@ set_languages("c++17")
 
 add_rules("mode.release", "mode.debug")
 
-add_requires("asio 1.24.0", "nlohmann_json", "spdlog 1.11.0")
+add_requires("asio 1.24.0", "nlohmann_json", "spdlog 1.11.0", "zlib")
 
 add_defines("ASIO_STANDALONE", "ASIO_HAS_STD_TYPE_TRAITS",
     "ASIO_HAS_STD_SHARED_PTR", "ASIO_HAS_STD_ADDRESSOF", "ASIO_HAS_STD_ATOMIC",
@@ -29,7 +29,7 @@ includes("thirdparty")
 target("log")
     set_kind("headeronly")
     add_packages("spdlog")
-    add_headerfiles("src/log/log.h")
+    add_headerfiles("src/log/log.h", "src/log/async_log_sink.h")
     add_includedirs("src/log", {public = true})
 
 target("common")
@@ -40,5 +40,62 @@ target("signal_server")
     set_kind("binary")
     add_deps("log", "common")
     add_files("src/*.cpp")
-    add_packages("asio", "nlohmann_json", "spdlog")
+    add_packages("asio", "nlohmann_json", "spdlog", "zlib")
     add_includedirs("thirdparty/websocketpp/include")
+
+target("relay_bench")
+    set_kind("binary")
+    set_default(false)
+    add_files("bench/relay_bench.cpp", "src/signal_message.cpp")
+    add_packages("nlohmann_json")
+    add_includedirs("src", "thirdparty/websocketpp/include")
+
+target("parse_bench")
+    set_kind("binary")
+    set_default(false)
+    add_files("bench/parse_bench.cpp", "src/signal_message.cpp")
+    add_packages("nlohmann_json")
+    add_includedirs("src")
+
+target("deflate_bench")
+    set_kind("binary")
+    set_default(false)
+    add_files("bench/deflate_bench.cpp", "src/deflate_extension.cpp",
+        "src/sdp_dictionary.cpp")
+    add_packages("nlohmann_json", "zlib")
+    add_includedirs("src", "thirdparty/websocketpp/include")
+
+target("journal_decode")
+    set_kind("binary")
+    set_default(false)
+    add_deps("log", "common")
+    add_files("tools/journal_decode.cpp", "src/event_journal.cpp")
+    add_packages("spdlog")
+    add_includedirs("src")
+
+target("signal_bench")
+    set_kind("binary")
+    set_default(false)
+    add_files("bench/signal_bench.cpp", "src/metrics.cpp")
+    add_packages("asio", "nlohmann_json")
+    add_includedirs("src", "thirdparty/websocketpp/include")
+
+target("transmission_bench")
+    set_kind("binary")
+    set_default(false)
+    add_deps("log")
+    add_files("bench/transmission_bench.cpp", "src/transmission_manager.cpp",
+        "src/id_interner.cpp")
+    add_packages("spdlog")
+    add_includedirs("src", "thirdparty/websocketpp/include")
+    add_defines("SPDLOG_ACTIVE_LEVEL=SPDLOG_LEVEL_OFF")
+
+target("signal_replay")
+    set_kind("binary")
+    set_default(false)
+    add_deps("log", "common")
+    add_files("src/*.cpp|main.cpp", "tools/signal_replay.cpp")
+    add_packages("asio", "nlohmann_json", "spdlog", "zlib")
+    add_includedirs("src", "thirdparty/websocketpp/include")
+    add_defines("SIGNAL_SERVER_IOSTREAM",
+        "SPDLOG_ACTIVE_LEVEL=SPDLOG_LEVEL_WARN")